@@ -0,0 +1,65 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+/*
+Fixture shared by the micro-benchmarks. A test runs <iterations> times per
+round, rounds are repeated BENCH_ROUNDS times after a warm-up one and the
+median is reported with the spread, as a single round is easily skewed by
+scheduling or frequency scaling
+*/
+
+#include <stdio.h>
+
+#include "squeezelite.h"
+
+#define BENCH_ROUNDS	9
+
+typedef u32_t (*bench_fn)(void *arg, int iterations);
+
+// what tests return ends up here, so that the compiler cannot drop the work
+static volatile u32_t bench_sink;
+
+/*---------------------------------------------------------------------------*/
+static inline double bench_run(const char *name, bench_fn fn, void *arg, int iterations)
+{
+	double ns[BENCH_ROUNDS], t;
+	int i, j;
+
+	bench_sink += fn(arg, iterations / 10 + 1);
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		u64_t start = gettime_us();
+
+		bench_sink += fn(arg, iterations);
+		t = (gettime_us() - start) * 1000.0 / iterations;
+		for (j = i; j > 0 && ns[j - 1] > t; j--) ns[j] = ns[j - 1];
+		ns[j] = t;
+	}
+
+	printf("  %-28s %9.1f ns (min %.1f, max %.1f)\n", name, ns[BENCH_ROUNDS / 2],
+		   ns[0], ns[BENCH_ROUNDS - 1]);
+
+	return ns[BENCH_ROUNDS / 2];
+}
+
+#endif
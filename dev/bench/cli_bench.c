@@ -0,0 +1,154 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Metadata extraction from LMS answers, parsing only (CLI round trips are not
+measured). The baseline is what sq_get_metadata used to do: one cli_find_tag
+(tag search, malloc and url_decode) per field of a "songinfo" answer, for a
+single track. It is compared to cli_parse_status on a "status" answer that
+holds STATUS_ITEMS tracks, decoded in place. Both answers follow what LMS 7.9
+sends (field order, escaping, header fields), with the command echo removed
+from the status one as cli_complete does
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define ITERATIONS	100000
+
+// cli.c is linked for cli_parse_status only, its thread is never started
+struct thread_ctx_s thread_ctx[MAX_PLAYER];
+void send_packet(u8_t *packet, size_t len, sockfd sock) { }
+void playlist_notify(struct thread_ctx_s *ctx) { }
+
+static const char cSongInfo[] =
+	"songinfo 0 10 url%3Afile%3A%2F%2F%2Fmusic%2FNina%20Simone%2FLittle%20Girl%20Blue%2F02%20Don't%20Smoke%20in%20Bed.flac "
+	"tags%3Acfldatgr id%3A4211 title%3ADon't%20Smoke%20in%20Bed coverid%3A8f2a6c1e "
+	"duration%3A163.466 filesize%3A18094522 album_id%3A312 album%3ALittle%20Girl%20Blue "
+	"artist_id%3A98 artist%3ANina%20Simone genre_id%3A7 genre%3AJazz tracknum%3A2";
+
+static const char cStatus[] =
+	"player_name%3ALiving%20Room player_connected%3A1 player_ip%3A192.168.1.31%3A49374 power%3A1 "
+	"signalstrength%3A0 mode%3Aplay time%3A41.2304401397705 rate%3A1 duration%3A163.466 can_seek%3A1 "
+	"mixer%20volume%3A35 playlist%20repeat%3A0 playlist%20shuffle%3A0 playlist%20mode%3Aoff seq_no%3A0 "
+	"playlist_cur_index%3A1 playlist_timestamp%3A1508437261.40532 playlist_tracks%3A13 "
+	"digital_volume_control%3A1 "
+	"playlist%20index%3A1 id%3A4211 title%3ADon't%20Smoke%20in%20Bed coverid%3A8f2a6c1e "
+	"artist%3ANina%20Simone album%3ALittle%20Girl%20Blue duration%3A163.466 genre%3AJazz tracknum%3A2 "
+	"url%3Afile%3A%2F%2F%2Fmusic%2FNina%20Simone%2FLittle%20Girl%20Blue%2F02%20Don't%20Smoke%20in%20Bed.flac "
+	"playlist%20index%3A2 id%3A4212 title%3AI%20Loves%20You%2C%20Porgy coverid%3A8f2a6c1e "
+	"artist%3ANina%20Simone album%3ALittle%20Girl%20Blue duration%3A250.24 genre%3AJazz tracknum%3A3 "
+	"url%3Afile%3A%2F%2F%2Fmusic%2FNina%20Simone%2FLittle%20Girl%20Blue%2F03%20I%20Loves%20You%2C%20Porgy.flac "
+	"playlist%20index%3A3 id%3A4213 title%3AMy%20Baby%20Just%20Cares%20for%20Me coverid%3A8f2a6c1e "
+	"artist%3ANina%20Simone album%3ALittle%20Girl%20Blue duration%3A218.733 genre%3AJazz tracknum%3A4 "
+	"url%3Afile%3A%2F%2F%2Fmusic%2FNina%20Simone%2FLittle%20Girl%20Blue%2F04%20My%20Baby%20Just%20Cares%20for%20Me.flac";
+
+/*---------------------------------------------------------------------------*/
+/* baseline, as it was in main.c                                             */
+static char *cli_find_tag(char *str, char *tag)
+{
+	char *p, *res = NULL;
+	char *buf = malloc(strlen(str));
+
+	strcpy(buf, tag);
+	strcat(buf, "%3a");
+	if ((p = stristr(str, buf))) {
+		int i = 0;
+		p += strlen(buf);
+		while (*(p+i) != ' ' && *(p+i) != '\n' && *(p+i)) i++;
+		if (i) {
+			strncpy(buf, p, i);
+			buf[i] = '\0';
+			res = url_decode(buf);
+		}
+	}
+	free(buf);
+	return res;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t find_tag(void *arg, int iterations)
+{
+	char *rsp = arg, *p;
+	sq_metadata_t metadata;
+	u32_t check = 0;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		memset(&metadata, 0, sizeof(metadata));
+		metadata.title = cli_find_tag(rsp, "title");
+		metadata.artist = cli_find_tag(rsp, "artist");
+		metadata.album = cli_find_tag(rsp, "album");
+		metadata.genre = cli_find_tag(rsp, "genre");
+		if ((p = cli_find_tag(rsp, "duration"))) {
+			metadata.duration = atol(p);
+			free(p);
+		}
+		if ((p = cli_find_tag(rsp, "filesize"))) {
+			metadata.file_size = atol(p);
+			free(p);
+		}
+		if ((p = cli_find_tag(rsp, "tracknum"))) {
+			metadata.track = atol(p);
+			free(p);
+		}
+		metadata.artwork = cli_find_tag(rsp, "coverid");
+		check += strlen(metadata.title) + metadata.duration;
+		NFREE(metadata.title); NFREE(metadata.artist); NFREE(metadata.album);
+		NFREE(metadata.genre); NFREE(metadata.artwork);
+	}
+
+	return check;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t parse_status(void *arg, int iterations)
+{
+	sq_metadata_t items[STATUS_ITEMS];
+	u32_t check = 0, cur;
+	int i, found;
+
+	for (i = 0; i < iterations; i++) {
+		// parsing is destructive, like the CLI thread the response is copied
+		char *rsp = strdup(arg);
+
+		memset(items, 0, sizeof(items));
+		found = cli_parse_status(rsp, false, &cur, items, STATUS_ITEMS);
+		if (found >= 0) check += strlen(items[found].title) + items[found].duration;
+		free(rsp);
+	}
+
+	return check;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	double baseline, status;
+
+	printf("metadata parse, %d iterations x %d rounds (median)\n", ITERATIONS, BENCH_ROUNDS);
+	baseline = bench_run("songinfo, cli_find_tag", find_tag, (void*) cSongInfo, ITERATIONS);
+	status = bench_run("status, cli_parse_status", parse_status, (void*) cStatus, ITERATIONS);
+	printf("  per track: %.1f ns vs %.1f ns (%d tracks per status)\n", baseline, status / STATUS_ITEMS, STATUS_ITEMS);
+
+	return 0;
+}
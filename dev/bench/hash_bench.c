@@ -0,0 +1,103 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Lookup of a renderer by ControlURL, with the hashed index used by CURL2Device
+(same sizing as in mr_util.c) versus the linear scan of all renderers'
+services it replaced. Keys share a long prefix, as real control urls do
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define ENTRIES		256
+#define INDEX_SIZE	(4*ENTRIES)
+#define LOOKUPS		1000000
+
+static char glKeys[ENTRIES][128];
+static hash_t glHash;
+
+/*---------------------------------------------------------------------------*/
+static void *linear(const char *key)
+{
+	int i;
+
+	for (i = 0; i < ENTRIES; i++) if (!strcmp(glKeys[i], key)) return glKeys[i];
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t scan(void *arg, int iterations)
+{
+	char **probes = arg;
+	u32_t found = 0;
+	int i;
+
+	for (i = 0; i < iterations; i++) found += linear(probes[i % ENTRIES]) != NULL;
+
+	return found;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t lookup(void *arg, int iterations)
+{
+	char **probes = arg;
+	u32_t found = 0;
+	int i;
+
+	for (i = 0; i < iterations; i++) found += hash_get(&glHash, probes[i % ENTRIES]) != NULL;
+
+	return found;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	static char *hits[ENTRIES], *misses[ENTRIES];
+	static char missed[ENTRIES][128];
+	int i;
+
+	hash_init(&glHash, INDEX_SIZE);
+
+	for (i = 0; i < ENTRIES; i++) {
+		sprintf(glKeys[i], "http://192.168.%d.%d:49152/upnp/control/AVTransport1", i / 64, i % 64 + 10);
+		sprintf(missed[i], "http://192.168.%d.%d:49152/upnp/control/RenderingControl1", i / 64, i % 64 + 10);
+		hash_put(&glHash, glKeys[i], glKeys[i]);
+	}
+
+	// visit entries in a scrambled order, so the scan does not always stop early
+	for (i = 0; i < ENTRIES; i++) {
+		hits[i] = glKeys[(i * 97) % ENTRIES];
+		misses[i] = missed[(i * 97) % ENTRIES];
+	}
+
+	printf("lookup among %d entries, %d lookups x %d rounds (median)\n", ENTRIES, LOOKUPS, BENCH_ROUNDS);
+	bench_run("hits, linear", scan, hits, LOOKUPS);
+	bench_run("hits, hashed", lookup, hits, LOOKUPS);
+	bench_run("misses, linear", scan, misses, LOOKUPS);
+	bench_run("misses, hashed", lookup, misses, LOOKUPS);
+
+	hash_free(&glHash);
+
+	return 0;
+}
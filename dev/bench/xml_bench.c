@@ -0,0 +1,116 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Extraction of the fields CallbackActionHandler looks for in an action answer:
+one XMLGetItems walk versus one XMLGetFirstDocumentItem (tag search + strdup)
+per field as it was done before. Both are the real ones from util.c. Answers
+are parsed once, only extraction is measured
+*/
+
+#include "bench.h"
+#include "util.h"
+
+#define ITERATIONS	200000
+
+static const char *cItems[] = { "RelTime", "CurrentTransportState", "CurrentURI" };
+
+static const struct {
+	char *name, *body;
+} cAnswers[] = {
+	{ "GetPositionInfo",
+	  "<u:GetPositionInfoResponse xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+	  "<Track>1</Track><TrackDuration>0:04:05</TrackDuration>"
+	  "<TrackMetaData>&lt;DIDL-Lite&gt;&lt;item&gt;&lt;dc:title&gt;Some Title&lt;/dc:title&gt;&lt;/item&gt;&lt;/DIDL-Lite&gt;</TrackMetaData>"
+	  "<TrackURI>http://192.168.1.10:49152/bridge-1.flac</TrackURI>"
+	  "<RelTime>0:01:23</RelTime><AbsTime>0:01:23</AbsTime>"
+	  "<RelCount>2147483647</RelCount><AbsCount>2147483647</AbsCount>"
+	  "</u:GetPositionInfoResponse>" },
+	{ "GetTransportInfo",
+	  "<u:GetTransportInfoResponse xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+	  "<CurrentTransportState>PLAYING</CurrentTransportState>"
+	  "<CurrentTransportStatus>OK</CurrentTransportStatus><CurrentSpeed>1</CurrentSpeed>"
+	  "</u:GetTransportInfoResponse>" },
+	{ "GetMediaInfo",
+	  "<u:GetMediaInfoResponse xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+	  "<NrTracks>1</NrTracks><MediaDuration>0:04:05</MediaDuration>"
+	  "<CurrentURI>http://192.168.1.10:49152/bridge-1.flac</CurrentURI>"
+	  "<CurrentURIMetaData>&lt;DIDL-Lite&gt;&lt;item&gt;&lt;dc:title&gt;Some Title&lt;/dc:title&gt;&lt;/item&gt;&lt;/DIDL-Lite&gt;</CurrentURIMetaData>"
+	  "<NextURI></NextURI><NextURIMetaData></NextURIMetaData>"
+	  "<PlayMedium>NETWORK</PlayMedium><RecordMedium>NOT_IMPLEMENTED</RecordMedium>"
+	  "<WriteStatus>NOT_IMPLEMENTED</WriteStatus>"
+	  "</u:GetMediaInfoResponse>" },
+};
+
+/*---------------------------------------------------------------------------*/
+static u32_t per_item(void *arg, int iterations)
+{
+	u32_t check = 0;
+	int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < 3; j++) {
+			char *value = XMLGetFirstDocumentItem(arg, cItems[j]);
+			if (value) check += strlen(value);
+			NFREE(value);
+		}
+	}
+
+	return check;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t single_walk(void *arg, int iterations)
+{
+	const char *Values[3];
+	u32_t check = 0;
+	int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		XMLGetItems(arg, cItems, Values, 3);
+		for (j = 0; j < 3; j++) if (Values[j]) check += strlen(Values[j]);
+	}
+
+	return check;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	unsigned i;
+
+	printf("action answer fields extraction, %d iterations x %d rounds (median)\n", ITERATIONS, BENCH_ROUNDS);
+
+	for (i = 0; i < sizeof(cAnswers) / sizeof(cAnswers[0]); i++) {
+		IXML_Document *doc = ixmlParseBuffer(cAnswers[i].body);
+
+		if (!doc) {
+			printf("%s: cannot parse\n", cAnswers[i].name);
+			continue;
+		}
+
+		printf("%s\n", cAnswers[i].name);
+		bench_run("XMLGetFirstDocumentItem x3", per_item, doc, ITERATIONS);
+		bench_run("XMLGetItems", single_walk, doc, ITERATIONS);
+		ixmlDocument_free(doc);
+	}
+
+	return 0;
+}
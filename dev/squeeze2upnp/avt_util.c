@@ -21,6 +21,7 @@
 
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <math.h>
 
 #include "upnptools.h"
@@ -28,6 +29,7 @@
 #include "util_common.h"
 #include "util.h"
 #include "avt_util.h"
+#include "soap.h"
 #include "squeeze2upnp.h"
 
 /*
@@ -114,6 +116,7 @@ typedef enum {
 " <upnp:album>%s</upnp:album>"
 " <upnp:genre>%s</upnp:genre>"
 " <upnp:originalTrackNumber>%d</upnp:originalTrackNumber>"
+"%s"
 " <res protocolInfo=\"%s%s\">%s</res>"
 " <upnp:class>object.item.audioItem.musicTrack</upnp:class>"
 " </item>"
@@ -127,230 +130,305 @@ so the ; might have to be removed
 
 char DLNA_OPT[] = ";DLNA.ORG_OP=01;DLNA.ORG_FLAGS=21700000000000000000000000000000";
 
-static log_level loglevel;
+/*
+Envelopes of actions without parameters never change (InstanceID is always 0)
+so they are built and serialized once for all renderers. Parameterized ones
+are templates, serialized in two parts between which the value of one argument
+is inserted before sending. Once created, an entry is never modified, so the
+mutex only protects the lookup
+*/
+#define MAX_CACHED_ACTIONS	16
+#define TEMPLATE_MARK		"@@"
+
+static struct sCachedAction {
+	char	*Name, *Service;
+	char	*Head, *Tail;		// serialized action, split at the template value
+} glActions[MAX_CACHED_ACTIONS];
+
+static ithread_mutex_t 	glActionsMutex;
+static log_level 		loglevel;
 
 /*----------------------------------------------------------------------------*/
 void AVTInit(log_level level)
 {
 	loglevel = level;
+	ithread_mutex_init(&glActionsMutex, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+static char *AlbumArt(struct sq_metadata_s *MetaData)
+{
+	char *Art;
+
+	// proxied by our webserver, so no escaping needed
+	if (!MetaData->artwork || strncmp(MetaData->artwork, "http", 4)) return strdup("");
+
+	Art = malloc(strlen(MetaData->artwork) + 64);
+	sprintf(Art, "<upnp:albumArtURI>%s</upnp:albumArtURI>", MetaData->artwork);
+
+	return Art;
 }
 
 /*----------------------------------------------------------------------------*/
-int AVTSetURI(char *ControlURL, char *URI, char *ProtInfo, struct sq_metadata_s *MetaData, void *Cookie)
+int AVTSetURI(char *ControlURL, char *URI, char *ProtInfo, struct sq_metadata_s *MetaData, u64_t Id)
 {
 	IXML_Document *ActionNode = NULL;
 	int rc;
-	char *DIDLData;
+	char *DIDLData, *Art = AlbumArt(MetaData);
 
 	DIDLData = malloc(strlen(MetaData->title) + 2*strlen(MetaData->artist) +
-			   strlen(MetaData->album) + strlen(MetaData->genre) + 5 +
+			   strlen(MetaData->album) + strlen(MetaData->genre) + strlen(Art) + 5 +
 			   strlen(ProtInfo) + strlen(URI) + strlen(DIDL) + strlen(DLNA_OPT) + 1);
 #ifndef DIDL_PATCH
 	if (ProtInfo[strlen(ProtInfo) - 1] == ':')
 		sprintf(DIDLData, DIDL, MetaData->title, MetaData->artist, MetaData->artist,
-				MetaData->album, MetaData->genre, MetaData->track, ProtInfo, DLNA_OPT + 1, URI);
+				MetaData->album, MetaData->genre, MetaData->track, Art, ProtInfo, DLNA_OPT + 1, URI);
 	else
 		sprintf(DIDLData, DIDL, MetaData->title, MetaData->artist, MetaData->artist,
-				MetaData->album, MetaData->genre, MetaData->track, ProtInfo, DLNA_OPT, URI);
+				MetaData->album, MetaData->genre, MetaData->track, Art, ProtInfo, DLNA_OPT, URI);
 #else
 	sprintf(DIDLData, DIDL, URI);
 #endif
 
-	LOG_INFO("uPNP setURI %s for %s (cookie %p)", URI, ControlURL, Cookie);
+	LOG_INFO("uPNP setURI %s for %s (id %llu)", URI, ControlURL, (unsigned long long) Id);
 	ActionNode =  UpnpMakeAction("SetAVTransportURI", AV_TRANSPORT, 0, NULL);
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", AV_TRANSPORT, "InstanceID", "0");
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", AV_TRANSPORT, "CurrentURI", URI);
 
 	UpnpAddToAction(&ActionNode, "SetAVTransportURI", AV_TRANSPORT, "CurrentURIMetaData", DIDLData);
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
-
+	rc = SOAPSendAction(ControlURL, AV_TRANSPORT, "SetAVTransportURI", ActionNode, SOAP_RETRY, CallbackActionHandler, Id);
 
 	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
+		LOG_ERROR("Error in SOAPSendAction -- %d", rc);
 	}
 
 	free(DIDLData);
+	free(Art);
 	if (ActionNode) ixmlDocument_free(ActionNode);
 
 	return rc;
 }
 
 /*----------------------------------------------------------------------------*/
-int AVTSetNextURI(char *ControlURL, char *URI, char *ProtInfo, struct sq_metadata_s *MetaData, void *Cookie)
+int AVTSetNextURI(char *ControlURL, char *URI, char *ProtInfo, struct sq_metadata_s *MetaData, u64_t Id)
 {
 	IXML_Document *ActionNode = NULL;
 	int rc;
-	char *DIDLData;
+	char *DIDLData, *Art = AlbumArt(MetaData);
 
 	DIDLData = malloc(strlen(MetaData->title) + 2*strlen(MetaData->artist) +
-			   strlen(MetaData->album) + strlen(MetaData->genre) +  5 +
+			   strlen(MetaData->album) + strlen(MetaData->genre) + strlen(Art) + 5 +
 			   strlen(ProtInfo) + strlen(URI) + strlen(DIDL) + strlen(DLNA_OPT) + 1);
 
 #ifndef DIDL_PATCH
 	if (ProtInfo[strlen(ProtInfo) - 1] == ':')
 		sprintf(DIDLData, DIDL, MetaData->title, MetaData->artist, MetaData->artist,
-				MetaData->album, MetaData->genre, MetaData->track, ProtInfo, DLNA_OPT + 1, URI);
+				MetaData->album, MetaData->genre, MetaData->track, Art, ProtInfo, DLNA_OPT + 1, URI);
 	else
 		sprintf(DIDLData, DIDL, MetaData->title, MetaData->artist, MetaData->artist,
-				MetaData->album, MetaData->genre, MetaData->track, ProtInfo, DLNA_OPT, URI);
+				MetaData->album, MetaData->genre, MetaData->track, Art, ProtInfo, DLNA_OPT, URI);
 #else
 	sprintf(DIDLData, DIDL, URI);
 #endif
 
-	LOG_INFO("uPNP setNextURI %s for %s (cookie %p)", URI, ControlURL, Cookie);
+	LOG_INFO("uPNP setNextURI %s for %s (id %llu)", URI, ControlURL, (unsigned long long) Id);
 	ActionNode =  UpnpMakeAction("SetNextAVTransportURI", AV_TRANSPORT, 0, NULL);
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", AV_TRANSPORT, "InstanceID", "0");
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", AV_TRANSPORT, "NextURI", URI);
 	UpnpAddToAction(&ActionNode, "SetNextAVTransportURI", AV_TRANSPORT, "NextURIMetaData", DIDLData);
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
+	rc = SOAPSendAction(ControlURL, AV_TRANSPORT, "SetNextAVTransportURI", ActionNode, SOAP_RETRY, CallbackActionHandler, Id);
 
 	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
+		LOG_ERROR("Error in SOAPSendAction -- %d", rc);
 	}
 
 	free(DIDLData);
+	free(Art);
 	if (ActionNode) ixmlDocument_free(ActionNode);
 
 	return rc;
 }
 
 /*----------------------------------------------------------------------------*/
-int AVTCallAction(char *ControlURL, char *Action, void *Cookie)
+/* actions mutex must be locked                                               */
+static struct sCachedAction *CachedAction(char *Name, char *Service, char *Template, ...)
 {
-	IXML_Document *ActionNode = NULL;
+	struct sCachedAction *p = NULL;
+	IXML_Document *Doc;
+	va_list args;
+	char *Arg, *Body, *Mark;
+	int i;
+
+	for (i = 0; i < MAX_CACHED_ACTIONS && glActions[i].Head; i++)
+		if (!strcmp(glActions[i].Name, Name) && !strcmp(glActions[i].Service, Service)) return glActions + i;
+
+	if (i == MAX_CACHED_ACTIONS) {
+		LOG_ERROR("too many cached actions %s", Name);
+		return NULL;
+	}
+
+	Doc = UpnpMakeAction(Name, Service, 0, NULL);
+	UpnpAddToAction(&Doc, Name, Service, "InstanceID", "0");
+
+	// name/value pairs, NULL terminated, template value is only a placeholder
+	va_start(args, Template);
+	while ((Arg = va_arg(args, char*)) != NULL) {
+		char *Value = va_arg(args, char*);
+		UpnpAddToAction(&Doc, Name, Service, Arg, (Template && !strcmp(Arg, Template)) ? TEMPLATE_MARK : Value);
+	}
+	va_end(args);
+
+	Body = ixmlPrintNode((IXML_Node*) Doc);
+	ixmlDocument_free(Doc);
+
+	p = glActions + i;
+	p->Name = Name;
+	p->Service = Service;
+	if (Template && (Mark = strstr(Body, TEMPLATE_MARK)) != NULL) {
+		*Mark = '\0';
+		p->Tail = strdup(Mark + strlen(TEMPLATE_MARK));
+	}
+	p->Head = strdup(Body);
+	ixmlFreeDOMString(Body);
+
+	LOG_DEBUG("cached action %s (template:%s)", Name, Template ? Template : "none");
+
+	return p;
+}
+
+/*----------------------------------------------------------------------------*/
+/* values are numbers or times, there is nothing to escape                    */
+static int SendCachedAction(struct sCachedAction *Action, char *ControlURL, char *Value, int Flags, u64_t Id)
+{
+	char *Body;
 	int rc;
 
-	LOG_SDEBUG("uPNP %s for %s (cookie %p)", Action, ControlURL, Cookie);
-	ActionNode =  UpnpMakeAction(Action, AV_TRANSPORT, 0, NULL);
-	UpnpAddToAction(&ActionNode, Action, AV_TRANSPORT, "InstanceID", "0");
+	if (!Action) return UPNP_E_OUTOF_MEMORY;
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
+	if (!Action->Tail) Body = Action->Head;
+	else {
+		if (!Value) Value = "";
+		Body = malloc(strlen(Action->Head) + strlen(Value) + strlen(Action->Tail) + 1);
+		sprintf(Body, "%s%s%s", Action->Head, Value, Action->Tail);
+	}
 
-	if (rc != UPNP_E_SUCCESS) LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
+	rc = SOAPSendBody(ControlURL, Action->Service, Action->Name, Body, Flags, CallbackActionHandler, Id);
 
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	if (Body != Action->Head) free(Body);
+	if (rc != UPNP_E_SUCCESS) LOG_ERROR("Error in SOAPSendBody -- %d", rc);
 
 	return rc;
 }
 
-
 /*----------------------------------------------------------------------------*/
-int AVTPlay(char *ControlURL, void *Cookie)
+int AVTCallAction(char *ControlURL, char *Action, u64_t Id)
 {
-	IXML_Document *ActionNode = NULL;
+	struct sCachedAction *Cached;
 	int rc;
 
-	LOG_INFO("uPNP play for %s (cookie %p)", ControlURL, Cookie);
-	ActionNode =  UpnpMakeAction("Play", AV_TRANSPORT, 0, NULL);
-	UpnpAddToAction(&ActionNode, "Play", AV_TRANSPORT, "InstanceID", "0");
-	UpnpAddToAction(&ActionNode, "Play", AV_TRANSPORT, "Speed", "1");
+	LOG_SDEBUG("uPNP %s for %s (id %llu)", Action, ControlURL, (unsigned long long) Id);
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
+	// only used for polling, can be dropped when renderer is busy
+	ithread_mutex_lock(&glActionsMutex);
+	Cached = CachedAction(Action, AV_TRANSPORT, NULL, NULL);
+	ithread_mutex_unlock(&glActionsMutex);
 
-	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
-	}
+	rc = SendCachedAction(Cached, ControlURL, NULL, SOAP_POLL, Id);
 
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	return rc;
+}
+
+
+/*----------------------------------------------------------------------------*/
+int AVTPlay(char *ControlURL, u64_t Id)
+{
+	struct sCachedAction *Action;
+	int rc;
+
+	LOG_INFO("uPNP play for %s (id %llu)", ControlURL, (unsigned long long) Id);
+
+	ithread_mutex_lock(&glActionsMutex);
+	Action = CachedAction("Play", AV_TRANSPORT, NULL, "Speed", "1", NULL);
+	ithread_mutex_unlock(&glActionsMutex);
+
+	rc = SendCachedAction(Action, ControlURL, NULL, 0, Id);
 
 	return rc;
 }
 
 /*----------------------------------------------------------------------------*/
-int SetVolume(char *ControlURL, u8_t Volume, void *Cookie)
+int SetVolume(char *ControlURL, u8_t Volume, u64_t Id)
 {
-	IXML_Document *ActionNode = NULL;
+	struct sCachedAction *Action;
 	int rc;
 	char params[8];
 
-	LOG_INFO("uPNP volume %d for %s (cookie %p)", Volume, ControlURL, Cookie);
-	ActionNode =  UpnpMakeAction("SetVolume", RENDERING_CTRL, 0, NULL);
-	UpnpAddToAction(&ActionNode, "SetVolume", RENDERING_CTRL, "InstanceID", "0");
-	UpnpAddToAction(&ActionNode, "SetVolume", RENDERING_CTRL, "Channel", "Master");
+	LOG_INFO("uPNP volume %d for %s (id %llu)", Volume, ControlURL, (unsigned long long) Id);
 	sprintf(params, "%d", (int) Volume);
-	UpnpAddToAction(&ActionNode, "SetVolume", RENDERING_CTRL, "DesiredVolume", params);
-
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, RENDERING_CTRL, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
 
-	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
-	}
+	ithread_mutex_lock(&glActionsMutex);
+	Action = CachedAction("SetVolume", RENDERING_CTRL, "DesiredVolume", "Channel", "Master", "DesiredVolume", "0", NULL);
+	ithread_mutex_unlock(&glActionsMutex);
 
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	rc = SendCachedAction(Action, ControlURL, params, SOAP_RETRY, Id);
 
 	return rc;
 }
 
 
 /*----------------------------------------------------------------------------*/
-int AVTSeek(char *ControlURL, unsigned Interval, void *Cookie)
+int AVTSeek(char *ControlURL, unsigned Interval, u64_t Id)
 {
-	IXML_Document *ActionNode = NULL;
+	struct sCachedAction *Action;
 	int rc;
 	char	params[128];
 
-	LOG_INFO("uPNP seek for %s (%ds) (cookie %p)", ControlURL, Interval, Cookie);
-	ActionNode =  UpnpMakeAction("Seek", AV_TRANSPORT, 0, NULL);
-	UpnpAddToAction(&ActionNode, "Seek", AV_TRANSPORT, "InstanceID", "0");
-	sprintf(params, "%d", (int) (Interval / 1000 + 0.5));
-	UpnpAddToAction(&ActionNode, "Seek", AV_TRANSPORT, "Unit", params);
-	UpnpAddToAction(&ActionNode, "Seek", AV_TRANSPORT, "Target", "REL_TIME");
-
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
+	LOG_INFO("uPNP seek for %s (%ds) (id %llu)", ControlURL, Interval, (unsigned long long) Id);
+	Interval = (Interval + 500) / 1000;
+	sprintf(params, "%d:%02d:%02d", Interval / 3600, (Interval % 3600) / 60, Interval % 60);
 
-	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
-	}
+	ithread_mutex_lock(&glActionsMutex);
+	Action = CachedAction("Seek", AV_TRANSPORT, "Target", "Unit", "REL_TIME", "Target", "0:00:00", NULL);
+	ithread_mutex_unlock(&glActionsMutex);
 
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	rc = SendCachedAction(Action, ControlURL, params, SOAP_RETRY, Id);
 
 	return rc;
 }
 
 /*----------------------------------------------------------------------------*/
-int AVTBasic(char *ControlURL, char *Action, void *Cookie)
+int AVTBasic(char *ControlURL, char *Action, u64_t Id)
 {
-	IXML_Document *ActionNode = NULL;
+	struct sCachedAction *Cached;
 	int rc;
 
-	LOG_INFO("uPNP %s for %s (cookie %p)", Action, ControlURL, Cookie);
-	ActionNode =  UpnpMakeAction(Action, AV_TRANSPORT, 0, NULL);
-	UpnpAddToAction(&ActionNode, Action, AV_TRANSPORT, "InstanceID", "0");
+	LOG_INFO("uPNP %s for %s (id %llu)", Action, ControlURL, (unsigned long long) Id);
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, AV_TRANSPORT, NULL,
-							 ActionNode, CallbackActionHandler, Cookie);
+	ithread_mutex_lock(&glActionsMutex);
+	Cached = CachedAction(Action, AV_TRANSPORT, NULL, NULL);
+	ithread_mutex_unlock(&glActionsMutex);
 
-	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
-	}
-
-	if (ActionNode) ixmlDocument_free(ActionNode);
+	// some renderers toggle on Pause, so only Stop is safe to re-send
+	rc = SendCachedAction(Cached, ControlURL, NULL, strcmp(Action, "Stop") ? 0 : SOAP_RETRY, Id);
 
 	return rc;
 }
-
-/*----------------------------------------------------------------------------*/
-int GetProtocolInfo(char *ControlURL, void *Cookie)
+
+/*----------------------------------------------------------------------------*/
+int GetProtocolInfo(char *ControlURL, u64_t Id)
 {
 	IXML_Document *ActionNode = NULL;
 	int rc;
 
-	LOG_SDEBUG("uPNP %s GetProtocolInfo (cookie %p)", ControlURL, Cookie);
+	LOG_SDEBUG("uPNP %s GetProtocolInfo (id %llu)", ControlURL, (unsigned long long) Id);
 	ActionNode =  UpnpMakeAction("GetProtocolInfo", CONNECTION_MGR, 0, NULL);
 
-	rc = UpnpSendActionAsync(glControlPointHandle, ControlURL, CONNECTION_MGR, NULL,
-							 ActionNode, CallbackEventHandler, Cookie);
+	rc = SOAPSendAction(ControlURL, CONNECTION_MGR, "GetProtocolInfo", ActionNode, SOAP_RETRY, CallbackEventHandler, Id);
 
 	if (rc != UPNP_E_SUCCESS) {
-		LOG_ERROR("Error in UpnpSendActionAsync -- %d", rc);
+		LOG_ERROR("Error in SOAPSendAction -- %d", rc);
 	}
 
 	if (ActionNode) ixmlDocument_free(ActionNode);
@@ -27,14 +27,14 @@
 struct sq_metadata_s;
 
 void AVTInit(log_level level);
-int AVTSetURI(char *ControlURL, char *URI, char *ProtocolInfo, struct sq_metadata_s *MetaData, void *Cookie);
-int AVTSetNextURI(char *ControlURL, char *URI, char *ProtocolInfo, struct sq_metadata_s *MetaData, void *Cookie);
-int AVTCallAction(char *ControlURL, char *Var, void *Cookie);
-int AVTPlay(char *ControlURL, void *Cookie);
-int SetVolume(char *ControlURL, u8_t Volume, void *Cookie);
-int AVTSeek(char *ControlURL, unsigned Interval, void *Cookie);
-int AVTBasic(char *ControlURL, char *Action, void *Cookie);
-int GetProtocolInfo(char *ControlURL, void *Cookie);
+int AVTSetURI(char *ControlURL, char *URI, char *ProtocolInfo, struct sq_metadata_s *MetaData, u64_t Id);
+int AVTSetNextURI(char *ControlURL, char *URI, char *ProtocolInfo, struct sq_metadata_s *MetaData, u64_t Id);
+int AVTCallAction(char *ControlURL, char *Var, u64_t Id);
+int AVTPlay(char *ControlURL, u64_t Id);
+int SetVolume(char *ControlURL, u8_t Volume, u64_t Id);
+int AVTSeek(char *ControlURL, unsigned Interval, u64_t Id);
+int AVTBasic(char *ControlURL, char *Action, u64_t Id);
+int GetProtocolInfo(char *ControlURL, u64_t Id);
 
 #endif
 
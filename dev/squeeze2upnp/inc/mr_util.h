@@ -7,22 +7,32 @@
 void 			MRutilInit(log_level level);
 void 			FlushActionList(struct sMR *Device);
 void 			InitActionList(struct sMR *Device);
-void			QueueAction(sq_dev_handle_t handle, struct sMR *Device, sq_action_t action, u8_t *cookie, void *param, bool sticky);
-struct sAction*	UnQueueAction(struct sMR *Device, bool Keep);
+void			QueueAction(sq_dev_handle_t handle, struct sMR *Device, sq_action_t action, u64_t WaitFor, void *param, bool sticky);
+bool			UnQueueAction(struct sMR *Device, struct sAction *Action, bool Keep);
+void			AckAction(struct sMR *Device, u64_t Id);
+
+void			InitScheduler(void);
+void			StopScheduler(void);
+void			ScheduleJob(struct sJob *Job, u32_t Delay);
+void			CancelJobs(struct sMR *Device);
 
 void 			FlushMRDevices(void);
 void 			DelMRDevice(struct sMR *p);
+void			IndexMRDevice(struct sMR *Device, bool Add);
 sq_dev_handle_t mr_GetSqHandle(struct sMR *Device);
 struct sMR* 	mr_File2Device(const char *FileName);
 struct sMR* 	SID2Device(Upnp_SID Sid);
 struct sMR* 	CURL2Device(char *CtrlURL);
+struct sMR* 	UDN2Device(char *UDN);
 struct sMR 		*IsDevice(void *Cookie);
 bool 			SetContentType(char *Cap[], sq_seturi_t *uri);
 
 void			SaveConfig(char *name);
+void			SaveMRCache(char *name);
 void		 	*LoadConfig(char *name, tMRConfig *Conf, sq_dev_param_t *sq_conf);
 void	 		*FindMRConfig(void *ref, char *UDN);
 void 			*LoadMRConfig(void *ref, char *UDN, tMRConfig *Conf, sq_dev_param_t *sq_conf);
 void 			ParseProtocolInfo(struct sMR *Device, char *Info);
+void 			CodecsFromProtocolInfo(char *Cap[], char *Allowed, char *Codecs);
 
 #endif
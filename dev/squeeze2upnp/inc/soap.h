@@ -0,0 +1,56 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  Squeezelite : (c) Adrian Smith 2012-2014, triode1@btinternet.com
+ *  Additions & gateway : (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __SOAP_H
+#define __SOAP_H
+
+#include "upnp.h"
+#include "util_common.h"
+
+#define SOAP_POLL		0x01		// can be collapsed or dropped
+#define SOAP_RETRY		0x02		// idempotent, can be re-sent
+
+#define SOAP_ACTIONS	16
+#define SOAP_BUCKETS	9
+#define SOAP_BOUNDS		{ 10, 25, 50, 100, 250, 500, 1000, 2500 }	// ms
+
+struct sSOAPLatency {
+	char	Action[32];
+	u32_t	Count, Max;
+	u32_t	Buckets[SOAP_BUCKETS];
+};
+
+struct sSOAPStats {
+	u32_t	Opened, Reused, Idle;
+	u32_t	Queued, Peak, Collapsed, Dropped;
+	struct sSOAPLatency Latency[SOAP_ACTIONS];
+};
+
+void 	SOAPInit(log_level level);
+void 	SOAPClose(void);
+int 	SOAPSendAction(char *ControlURL, char *Service, char *Action, IXML_Document *Doc,
+					   int Flags, Upnp_FunPtr Callback, u64_t Id);
+int 	SOAPSendBody(char *ControlURL, char *Service, char *Action, const char *Body,
+					 int Flags, Upnp_FunPtr Callback, u64_t Id);
+int 	SOAPProbe(char *URL, Upnp_FunPtr Callback, void *Cookie);
+void 	SOAPStats(struct sSOAPStats *Stats);
+
+#endif
@@ -44,10 +44,41 @@
 #define RESOURCE_LENGTH	250
 #define	SCAN_TIMEOUT 	15
 #define SCAN_INTERVAL	30
+#define SUBSCRIBE_TIMEOUT	1800
+#define ACTION_DEADLINE		10000
+#define MAX_ACTIONS			8
+#define VOLUME_LUT			128
 
 
 enum eMRstate {STOPPED, PLAYING, PAUSED, TRANSITIONING};
 enum {AVT_SRV_IDX = 0, REND_SRV_IDX, CNX_MGR_IDX, NB_SRV};
+enum {STATE_JOB = 0, POSITION_JOB, PROBE_JOB, VOLUME_JOB, SUBSCRIBE_JOB, NB_JOBS};
+enum eBreaker {BREAKER_CLOSED, BREAKER_OPEN, BREAKER_HALF};
+
+struct sMR;
+
+// periodic per-renderer work, run by the scheduler thread
+struct sJob {
+	struct sJob	*Next;
+	u32_t		Expiry;
+	bool		Armed;
+	u32_t		(*Run)(struct sMR *Device);		// returns next interval, 0 to disarm
+	struct sMR	*Device;
+};
+
+struct sAction	{
+	sq_dev_handle_t Handle;
+	struct sMR		*Caller;
+	sq_action_t 	Action;
+	u64_t			WaitFor;			// ordered: id of the action to be answered first
+	u32_t			Deadline;
+	bool			Acked;				// ordered: WaitFor has been answered
+	union {
+		u32_t	Volume;
+		u32_t	Time;
+	} 				Param;
+	bool			Ordered;
+};
 
 struct sService {
 	char Id			[RESOURCE_LENGTH];
@@ -95,42 +126,38 @@ struct sMR {
 	sq_metadata_t	NextMetaData;
 	sq_action_t		sqState;
 	u32_t			Elapsed;
-	u8_t			*seqN;
-	unsigned	TrackPoll, StatePoll;
+	u64_t			ActionId;			// last id given to an action sent to renderer
+	struct sJob	Jobs[NB_JOBS];
+	bool		Eventing;			// renderer events confirmed, polling is only a health check
+	bool		EventingURI;		// URI changes are evented too, no need to poll media info
 	bool		uPNPTimeOut;
 	int	 SqueezeHandle;
 	struct sService Service[NB_SRV];
-	struct sAction	*Actions;
-	u8_t			*LastAckAction;
+	struct sAction	Actions[MAX_ACTIONS];	// ring, see QueueAction
+	u8_t			ActionHead, ActionCount;
 	ithread_mutex_t  ActionsMutex;
 	ithread_mutex_t  Mutex;
-	ithread_t 		 Thread;
 	u8_t		Volume;
 	struct {
 		u32_t	a;
 		u8_t	b;
 	} VolumeCurve[32];
+	struct {
+		u32_t	Key;
+		u8_t	Volume;
+	} VolumeLUT[VOLUME_LUT];			// gain to volume, filled on first use
+	u32_t	VolumeSent;
+	bool	VolumePending;
 	char	*ProtocolCap[MAX_PROTO + 1];
+	char	*Description;		// description document, kept for the cache
 	u16_t	ErrorCount;
+	enum eBreaker	Breaker;	// open: no polling, only probing until renderer answers
+	u32_t			ProbeDelay;
 	int	uPNPMissingCount;
-	bool	Running;
 	struct sMR	*NextSQ;
 	struct sMR	*Next;
 };
 
-struct sAction	{
-	sq_dev_handle_t Handle;
-	struct sMR		*Caller;
-	sq_action_t 	Action;
-	u8_t 			*Cookie;
-	union {
-		u32_t	Volume;
-		u32_t	Time;
-	} 				Param;
-	struct sAction	*Next;
-	bool			Ordered;
-};
-
 extern UpnpClient_Handle   	glControlPointHandle;
 extern unsigned int 		glPort;
 extern char 				glIPaddress[];
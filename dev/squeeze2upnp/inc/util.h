@@ -31,13 +31,15 @@
 #include "util_common.h"
 
 char 		*XMLGetFirstDocumentItem(IXML_Document *doc, const char *item);
+char 		*XMLGetFirstElementItem(IXML_Element *element, const char *item);
+int			XMLGetItems(IXML_Document *doc, const char *Items[], const char *Values[], int n);
 int 		XMLFindAndParseService(IXML_Document *DescDoc, const char *location,
 							const char *serviceType, char **serviceId,
 							char **eventURL, char **controlURL);
 char 		*uPNPEvent2String(Upnp_EventType S);
 void 		uPNPUtilInit(log_level level);
 void 		ExtractIP(const char *URL, in_addr_t *IP);
-unsigned 	Time2Int(char *Time);
+unsigned 	Time2Int(const char *Time);
 char 		*XMLGetChangeItem(IXML_Document *doc, char *Item);
 IXML_Node 	*XMLAddNode(IXML_Document *doc, IXML_Node *parent, char *name, char *fmt, ...);
 
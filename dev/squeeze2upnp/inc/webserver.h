@@ -38,6 +38,9 @@ int WebWrite(UpnpWebFileHandle FileHandle, char *buf, size_t buflen);
 int WebSeek(UpnpWebFileHandle FileHandle, off_t offset, int origin);
 int WebClose(UpnpWebFileHandle FileHandle);
 void WebServerLogLevel(log_level level);
+void ArtworkInit(void);
+void ArtworkClose(void);
+char *ArtworkProxy(char *URL);
 
 extern char glBaseVDIR[];
 
@@ -28,12 +28,208 @@
 #include "util.h"
 #include "util_common.h"
 
+/*
+Hashed timer wheel: one thread runs all periodic renderer jobs. A job sits in
+the slot of its expiry tick and is only run when that slot comes around and
+its expiry is reached (it might be due a few rounds later)
+*/
+#define WHEEL_TICK		50
+#define WHEEL_SLOTS		128
+
+static struct sJob		*glWheel[WHEEL_SLOTS];
+static struct sJob		*glRunningJob;
+static ithread_mutex_t	glWheelMutex;
+static ithread_cond_t	glWheelCond;
+static ithread_t		glWheelThread;
+static bool				glWheelRunning;
+
+/*
+Renderers are found by ControlURL (each action answer) and by UDN (each SSDP
+announce) using hashed indexes updated when renderers are added/removed
+*/
+#define INDEX_SIZE		(4*MAX_RENDERERS)
+
+static hash_t			glCURLIndex, glUDNIndex;
+
+// renderers cache is only re-written when the set of renderers or their
+// capabilities have changed. Set from several threads, so only atomically
+static volatile bool	glCacheDirty;
+
 static log_level loglevel = lWARN;
 
 /*----------------------------------------------------------------------------*/
 void MRutilInit(log_level level)
 {
 	loglevel = level;
+	hash_init(&glCURLIndex, INDEX_SIZE);
+	hash_init(&glUDNIndex, INDEX_SIZE);
+}
+
+/*----------------------------------------------------------------------------*/
+void IndexMRDevice(struct sMR *Device, bool Add)
+{
+	int i;
+
+	for (i = 0; i < NB_SRV; i++) {
+		if (Add) hash_put(&glCURLIndex, Device->Service[i].ControlURL, Device);
+		else hash_del(&glCURLIndex, Device->Service[i].ControlURL, Device);
+	}
+
+	if (Add) hash_put(&glUDNIndex, Device->UDN, Device);
+	else hash_del(&glUDNIndex, Device->UDN, Device);
+
+	__sync_lock_test_and_set(&glCacheDirty, true);
+}
+
+/*----------------------------------------------------------------------------*/
+/* wheel mutex must be locked                                                 */
+static void WheelInsert(struct sJob *Job)
+{
+	struct sJob **p = glWheel + (Job->Expiry / WHEEL_TICK) % WHEEL_SLOTS;
+
+	Job->Next = *p;
+	*p = Job;
+	Job->Armed = true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* wheel mutex must be locked                                                 */
+static void WheelRemove(struct sJob *Job)
+{
+	struct sJob **p = glWheel + (Job->Expiry / WHEEL_TICK) % WHEEL_SLOTS;
+
+	while (*p && *p != Job) p = &(*p)->Next;
+	if (*p) *p = Job->Next;
+	Job->Armed = false;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *SchedulerThread(void *args)
+{
+	u32_t Tick = gettime_ms() / WHEEL_TICK * WHEEL_TICK;
+
+	ithread_mutex_lock(&glWheelMutex);
+
+	while (glWheelRunning) {
+		u32_t now = gettime_ms();
+
+		// no need to go around more than once after a long sleep
+		if ((s32_t) (now - Tick) > WHEEL_SLOTS * WHEEL_TICK) Tick = (now / WHEEL_TICK - WHEEL_SLOTS) * WHEEL_TICK;
+
+		// a slot is processed once its whole tick has elapsed
+		for (; (s32_t) (Tick + WHEEL_TICK - 1 - now) <= 0; Tick += WHEEL_TICK) {
+			struct sJob **p = glWheel + (Tick / WHEEL_TICK) % WHEEL_SLOTS;
+
+			while (*p) {
+				struct sJob *Job = *p;
+				u32_t Next;
+
+				if ((s32_t) (Job->Expiry - now) > 0) {
+					p = &Job->Next;
+					continue;
+				}
+
+				*p = Job->Next;
+				Job->Armed = false;
+
+				// job takes renderer's mutex, so never run it with the wheel locked
+				glRunningJob = Job;
+				ithread_mutex_unlock(&glWheelMutex);
+				Next = Job->Run(Job->Device);
+				ithread_mutex_lock(&glWheelMutex);
+				glRunningJob = NULL;
+
+				// might have been re-armed meanwhile, keep the earliest
+				if (Next) {
+					Next += gettime_ms();
+					if (Job->Armed && (s32_t) (Next - Job->Expiry) < 0) WheelRemove(Job);
+					if (!Job->Armed) {
+						Job->Expiry = Next;
+						WheelInsert(Job);
+					}
+				}
+
+				ithread_cond_broadcast(&glWheelCond);
+
+				// slot might have changed while unlocked
+				p = glWheel + (Tick / WHEEL_TICK) % WHEEL_SLOTS;
+			}
+		}
+
+		ithread_mutex_unlock(&glWheelMutex);
+		usleep(WHEEL_TICK * 1000);
+		ithread_mutex_lock(&glWheelMutex);
+	}
+
+	ithread_mutex_unlock(&glWheelMutex);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+void InitScheduler(void)
+{
+	memset(glWheel, 0, sizeof(glWheel));
+	glRunningJob = NULL;
+	glWheelRunning = true;
+	ithread_mutex_init(&glWheelMutex, 0);
+	ithread_cond_init(&glWheelCond, 0);
+	ithread_create(&glWheelThread, NULL, &SchedulerThread, NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+void StopScheduler(void)
+{
+	if (!glWheelRunning) return;
+
+	ithread_mutex_lock(&glWheelMutex);
+	glWheelRunning = false;
+	ithread_mutex_unlock(&glWheelMutex);
+
+	ithread_join(glWheelThread, NULL);
+	ithread_cond_destroy(&glWheelCond);
+	ithread_mutex_destroy(&glWheelMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+void ScheduleJob(struct sJob *Job, u32_t Delay)
+{
+	// not earlier than next tick, current one might be processed already
+	u32_t Expiry = gettime_ms() + (Delay > WHEEL_TICK ? Delay : WHEEL_TICK);
+
+	if (!glWheelRunning || !Job->Run) return;
+
+	ithread_mutex_lock(&glWheelMutex);
+
+	// an armed job is only brought forward, never delayed
+	if (!Job->Armed || (s32_t) (Expiry - Job->Expiry) < 0) {
+		if (Job->Armed) WheelRemove(Job);
+		Job->Expiry = Expiry;
+		WheelInsert(Job);
+	}
+
+	ithread_mutex_unlock(&glWheelMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/* must not be called with the renderer's mutex locked                        */
+void CancelJobs(struct sMR *Device)
+{
+	int i;
+
+	if (!glWheelRunning) return;
+
+	ithread_mutex_lock(&glWheelMutex);
+
+	while (glRunningJob && glRunningJob->Device == Device)
+		ithread_cond_wait(&glWheelCond, &glWheelMutex);
+
+	for (i = 0; i < NB_JOBS; i++) {
+		if (Device->Jobs[i].Armed) WheelRemove(Device->Jobs + i);
+		Device->Jobs[i].Run = NULL;
+	}
+
+	ithread_mutex_unlock(&glWheelMutex);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -132,41 +328,84 @@ bool SetContentType(char *Cap[], sq_seturi_t *uri)
 	}
 }
 
+/*
+Actions waiting for the renderer are kept in a small ring per device, so that
+nothing is allocated on the control path. A new action is coalesced with the
+pending ones when it supersedes them: PLAY cancels a PAUSE not sent yet and a
+repeated PLAY or PAUSE is ignored, while each VOLUME and SEEK is queued. Ordered
+actions wait for a given answer, so they are never merged and, when the ring is
+full, a pending non-ordered action is dropped to make room for them. Otherwise
+the new action is refused
+*/
+
 /*----------------------------------------------------------------------------*/
 void FlushActionList(struct sMR *Device)
 {
-	struct sAction *p;
-
 	ithread_mutex_lock(&Device->ActionsMutex);
-	p = Device->Actions;
-	while (Device->Actions) {
-		p = Device->Actions;
-		Device->Actions = Device->Actions->Next;
-		free(p);
-	}
+	Device->ActionHead = Device->ActionCount = 0;
 	ithread_mutex_unlock(&Device->ActionsMutex);
 }
 
 /*----------------------------------------------------------------------------*/
 void InitActionList(struct sMR *Device)
 {
-	Device->Actions = NULL;
+	Device->ActionHead = Device->ActionCount = 0;
 	ithread_mutex_init(&Device->ActionsMutex, 0);
 }
 
 /*----------------------------------------------------------------------------*/
-void QueueAction(sq_dev_handle_t handle, struct sMR *Device, sq_action_t action, u8_t *cookie, void *param, bool ordered)
+void QueueAction(sq_dev_handle_t handle, struct sMR *Device, sq_action_t action, u64_t WaitFor, void *param, bool ordered)
 {
-	struct sAction *Action = malloc(sizeof(struct sAction));
-	struct sAction *p;
+	struct sAction *Action, *Last = NULL;
 
-	LOG_INFO("[%p]: queuing action %d", Device, action);
+	ithread_mutex_lock(&Device->ActionsMutex);
+
+	if (Device->ActionCount) Last = Device->Actions + (Device->ActionHead + Device->ActionCount - 1) % MAX_ACTIONS;
+
+	if (!ordered && Last && !Last->Ordered) {
+		if ((action == SQ_PLAY || action == SQ_UNPAUSE) && Last->Action == SQ_PAUSE) {
+			Device->ActionCount--;
+			ithread_mutex_unlock(&Device->ActionsMutex);
+			LOG_INFO("[%p]: action %d cancels pending pause", Device, action);
+			return;
+		}
+
+		if (action == Last->Action && action != SQ_VOLUME && action != SQ_SEEK) {
+			ithread_mutex_unlock(&Device->ActionsMutex);
+			LOG_INFO("[%p]: action %d already pending", Device, action);
+			return;
+		}
+	}
+
+	if (Device->ActionCount == MAX_ACTIONS) {
+		int i, j;
+
+		// oldest non-ordered one makes room, but not the head being processed
+		for (i = 1; ordered && i < MAX_ACTIONS; i++) {
+			if (!Device->Actions[(Device->ActionHead + i) % MAX_ACTIONS].Ordered) break;
+		}
+
+		if (!ordered || i == MAX_ACTIONS) {
+			ithread_mutex_unlock(&Device->ActionsMutex);
+			LOG_WARN("[%p]: action queue full, dropping %d", Device, action);
+			return;
+		}
+
+		LOG_WARN("[%p]: action queue full, dropping %d", Device, Device->Actions[(Device->ActionHead + i) % MAX_ACTIONS].Action);
+		for (j = i; j < MAX_ACTIONS - 1; j++) {
+			Device->Actions[(Device->ActionHead + j) % MAX_ACTIONS] = Device->Actions[(Device->ActionHead + j + 1) % MAX_ACTIONS];
+		}
+		Device->ActionCount--;
+	}
+
+	Action = Device->Actions + (Device->ActionHead + Device->ActionCount++) % MAX_ACTIONS;
 
 	Action->Handle  = handle;
 	Action->Caller  = Device;
 	Action->Action  = action;
-	Action->Cookie  = cookie;
-	Action->Next	= NULL;
+	Action->WaitFor = WaitFor;
+	Action->Deadline = gettime_ms() + ACTION_DEADLINE;
+	Action->Acked	= false;
 	Action->Ordered	= ordered;
 
 	switch(action) {
@@ -180,38 +419,56 @@ void FlushActionList(struct sMR *Device)
 		break;
 	}
 
-	ithread_mutex_lock(&Device->ActionsMutex);
-	if (!Device->Actions) Device->Actions = Action;
-	else {
-		p = Device->Actions;
-		while (p->Next) p = p->Next;
-		p->Next = Action;
-	}
 	ithread_mutex_unlock(&Device->ActionsMutex);
+
+	LOG_INFO("[%p]: queuing action %d", Device, action);
 }
 
 /*----------------------------------------------------------------------------*/
-struct sAction *UnQueueAction(struct sMR *Device, bool Keep)
+/* action is copied as its slot can be re-used as soon as it is un-queued     */
+bool UnQueueAction(struct sMR *Device, struct sAction *Action, bool Keep)
 {
-	struct sAction  *p = NULL;
-
-	if (Keep) return Device->Actions;
+	struct sAction *p;
 
 	ithread_mutex_lock(&Device->ActionsMutex);
-	if (Device->Actions) {
-		p = Device->Actions;
-		Device->Actions = Device->Actions->Next;
+
+	if (!Device->ActionCount) {
+		ithread_mutex_unlock(&Device->ActionsMutex);
+		return false;
+	}
+
+	p = Device->Actions + Device->ActionHead;
+	if (Action) *Action = *p;
+
+	if (!Keep) {
+		Device->ActionHead = (Device->ActionHead + 1) % MAX_ACTIONS;
+		Device->ActionCount--;
+		LOG_INFO("[%p]: un-queuing action %d", p->Caller, p->Action);
+		if (p->Caller != Device) {
+			LOG_ERROR("[%p]: action in wrong queue %p", Device, p->Caller);
+		}
 	}
+
 	ithread_mutex_unlock(&Device->ActionsMutex);
 
-	if (!p) return NULL;
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* completions come in any order, only the awaited id releases an action      */
+void AckAction(struct sMR *Device, u64_t Id)
+{
+	struct sAction *p;
+	int i;
+
+	ithread_mutex_lock(&Device->ActionsMutex);
 
-	LOG_INFO("[%p]: un-queuing action %d", p->Caller, p->Action);
-	if (p->Caller != Device) {
-		LOG_ERROR("[%p]: action in wrong queue %p", Device, p->Caller);
+	for (i = 0; i < Device->ActionCount; i++) {
+		p = Device->Actions + (Device->ActionHead + i) % MAX_ACTIONS;
+		if (p->Ordered && p->WaitFor == Id) p->Acked = true;
 	}
 
-	return p;
+	ithread_mutex_unlock(&Device->ActionsMutex);
 }
 
 
@@ -230,14 +487,22 @@ void DelMRDevice(struct sMR *p)
 {
 	int i = 0;
 
+	// renderer might be gone already, so do not wait for (nor care about) result
+	for (i = 0; i < NB_SRV; i++) {
+		if (*p->Service[i].SID) UpnpUnSubscribeAsync(glControlPointHandle, p->Service[i].SID, CallbackEventHandler, NULL);
+		*p->Service[i].SID = '\0';
+	}
+
+	i = 0;
+	IndexMRDevice(p, false);
+	CancelJobs(p);
 	ithread_mutex_lock(&p->Mutex);
-	p->Running = false;
-	ithread_join(p->Thread, NULL);
 	p->InUse = false;
 
 	FlushActionList(p);
 	NFREE(p->CurrentURI);
 	NFREE(p->NextURI);
+	NFREE(p->Description);
 	while (p->ProtocolCap[i] && i < MAX_PROTO) {
 		NFREE(p->ProtocolCap[i]);
 		i++;
@@ -249,20 +514,44 @@ void DelMRDevice(struct sMR *p)
 
 
 /*----------------------------------------------------------------------------*/
-struct sMR* CURL2Device(char *CtrlURL)
-{
-	int i, j;
+struct sMR* SID2Device(Upnp_SID Sid)
+{
+	int i, j;
 
 	for (i = 0; i < MAX_RENDERERS; i++) {
 		if (!glMRDevices[i].InUse) continue;
 		for (j = 0; j < NB_SRV; j++) {
-			if (!strcmp(glMRDevices[i].Service[j].ControlURL, CtrlURL)) {
-				return &glMRDevices[i];
-			}
+			if (*Sid && !strcmp(glMRDevices[i].Service[j].SID, Sid)) {
+				return &glMRDevices[i];
+			}
 		}
 	}
-
-	return NULL;
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+struct sMR *IsDevice(void *Cookie)
+{
+	struct sMR *Device = (struct sMR*) Cookie;
+
+	if (Device >= glMRDevices && Device < glMRDevices + MAX_RENDERERS &&
+		((char*) Cookie - (char*) glMRDevices) % sizeof(struct sMR) == 0 &&
+		Device->InUse) return Device;
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+struct sMR* CURL2Device(char *CtrlURL)
+{
+	return hash_get(&glCURLIndex, CtrlURL);
+}
+
+/*----------------------------------------------------------------------------*/
+struct sMR* UDN2Device(char *UDN)
+{
+	return hash_get(&glUDNIndex, UDN);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -273,6 +562,8 @@ void ParseProtocolInfo(struct sMR *Device, char *Info)
 	int size = strlen(Info);
 
 	// strtok is no re-entrant
+	for (i = 0; i < MAX_PROTO && Device->ProtocolCap[i]; i++) free(Device->ProtocolCap[i]);
+	i = 0;
 	memset(Device->ProtocolCap, 0, sizeof(char*) * (MAX_PROTO + 1));
 	do {
 		p = strtok(p, ",");
@@ -288,6 +579,68 @@ void ParseProtocolInfo(struct sMR *Device, char *Info)
 	// remove trailing "*" as we WILL add DLNA-related info, so some options to come
 	for (i = 0; (p = Device->ProtocolCap[i]); i++)
 		if (p[strlen(p) - 1] == '*') p[strlen(p) - 1] = '\0';
+
+	__sync_lock_test_and_set(&glCacheDirty, true);
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+LMS uses natively any codec in the list and otherwise transcodes to the first
+one it can produce, so order is by increasing cost: pcm is just a decode,
+flac is a light encode and mp3 a heavy one. Others are only for native use
+*/
+static const struct {
+	char	*codec;
+	char	*mime[5];
+} cCodecs[] = {
+	{ "pcm", { "audio/L", "audio/wav", "audio/x-wav", "audio/wave", NULL } },
+	{ "flc", { "audio/x-flac", "audio/flac", NULL } },
+	{ "mp3", { "audio/mp3", "audio/mpeg", "audio/mpeg3", NULL } },
+	{ "aac", { "audio/x-aac", "audio/aac", "audio/m4a", "audio/mp4", NULL } },
+	{ "ogg", { "audio/ogg", NULL } },
+	{ "wma", { "audio/x-wma", "audio/wma", NULL } },
+	{ "alc", { "audio/alac", "audio/x-alac", "audio/apple-lossless", NULL } },
+	{ NULL, { NULL } }
+};
+
+/*----------------------------------------------------------------------------*/
+static bool InList(char *List, char *Item)
+{
+	size_t len = strlen(Item);
+	char *p = List;
+
+	// whole comma-separated tokens only, "mp3" must not match "mp3x"
+	while ((p = strstr(p, Item)) != NULL) {
+		if ((p == List || p[-1] == ',' || p[-1] == ' ') &&
+			(p[len] == '\0' || p[len] == ',' || p[len] == ' ')) return true;
+		p += len;
+	}
+
+	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+void CodecsFromProtocolInfo(char *Cap[], char *Allowed, char *Codecs)
+{
+	int i, j;
+	char **p;
+
+	*Codecs = '\0';
+
+	for (i = 0; cCodecs[i].codec; i++) {
+		// <codecs> is the list of what the user allows
+		if (!InList(Allowed, cCodecs[i].codec)) continue;
+
+		for (p = Cap; *p; p++) {
+			for (j = 0; cCodecs[i].mime[j] && !strstr(*p, cCodecs[i].mime[j]); j++);
+			if (cCodecs[i].mime[j]) break;
+		}
+
+		if (*p) {
+			if (*Codecs) strcat(Codecs, ",");
+			strcat(Codecs, cCodecs[i].codec);
+		}
+	}
 }
 
 
@@ -395,6 +748,10 @@ void SaveConfig(char *name)
 			XMLAddNode(doc, dev_node, "flac_header", "%d", (int) p->sq_config.flac_header);
 		if (p->Config.uPNPRemoveCount != glMRConfig.uPNPRemoveCount)
 			XMLAddNode(doc, dev_node, "upnp_remove_count", "%d", (int) p->Config.uPNPRemoveCount);
+		if (p->sq_config.play_latency != glDeviceParam.play_latency)
+			XMLAddNode(doc, dev_node, "play_latency", "%u", (u32_t) p->sq_config.play_latency);
+		if (p->sq_config.output_delay != glDeviceParam.output_delay)
+			XMLAddNode(doc, dev_node, "output_delay", "%u", (u32_t) p->sq_config.output_delay);
 
 		p = p->Next;
 	}
@@ -408,6 +765,81 @@ void SaveConfig(char *name)
 	ixmlDocument_free(doc);
 }
 
+/*----------------------------------------------------------------------------*/
+void SaveMRCache(char *name)
+{
+	IXML_Document *doc;
+	IXML_Node *root;
+	FILE *file;
+	char *s, *tmp;
+	bool done = false;
+	int i, j;
+
+	// cleared first, so that a change while building is saved next time
+	if (!__sync_lock_test_and_set(&glCacheDirty, false)) return;
+
+	doc = ixmlDocument_createDocument();
+	root = XMLAddNode(doc, NULL, "renderers", NULL);
+
+	for (i = 0; i < MAX_RENDERERS; i++) {
+		struct sMR *p = &glMRDevices[i];
+		IXML_Node *dev_node, *node;
+		char *Info;
+		size_t len = 1;
+
+		if (!p->InUse || !p->Description) continue;
+
+		ithread_mutex_lock(&p->Mutex);
+		dev_node = XMLAddNode(doc, root, "renderer", NULL);
+		XMLAddNode(doc, dev_node, "udn", p->UDN);
+		XMLAddNode(doc, dev_node, "location", p->DescDocURL);
+		XMLAddNode(doc, dev_node, "mac", "%02x:%02x:%02x:%02x:%02x:%02x", p->sq_config.mac[0],
+					p->sq_config.mac[1], p->sq_config.mac[2], p->sq_config.mac[3], p->sq_config.mac[4], p->sq_config.mac[5]);
+
+		// ProtocolInfo and description are too large for XMLAddNode
+		for (j = 0; p->ProtocolCap[j]; j++) len += strlen(p->ProtocolCap[j]) + 1;
+		if (len > 1) {
+			Info = calloc(len, 1);
+			for (j = 0; p->ProtocolCap[j]; j++) {
+				if (j) strcat(Info, ",");
+				strcat(Info, p->ProtocolCap[j]);
+			}
+			node = XMLAddNode(doc, dev_node, "protocol_info", NULL);
+			ixmlNode_appendChild(node, ixmlDocument_createTextNode(doc, Info));
+			free(Info);
+		}
+
+		node = XMLAddNode(doc, dev_node, "description", NULL);
+		ixmlNode_appendChild(node, ixmlDocument_createTextNode(doc, p->Description));
+		ithread_mutex_unlock(&p->Mutex);
+	}
+
+	// written aside then renamed, so an interrupted write cannot corrupt it
+	tmp = malloc(strlen(name) + 5);
+	sprintf(tmp, "%s.tmp", name);
+	s = ixmlDocumenttoString(doc);
+
+	if ((file = fopen(tmp, "wb")) != NULL) {
+		done = fwrite(s, 1, strlen(s), file) == strlen(s);
+		done = !fclose(file) && done;
+#if WIN
+		// rename does not overwrite on Windows
+		if (done) remove(name);
+#endif
+		done = done && !rename(tmp, name);
+	}
+
+	if (!done) {
+		LOG_WARN("cannot write renderers cache %s", name);
+		remove(tmp);
+		__sync_lock_test_and_set(&glCacheDirty, true);
+	}
+
+	free(s);
+	free(tmp);
+	ixmlDocument_free(doc);
+}
+
 /*----------------------------------------------------------------------------*/
 static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name, char *val)
 {
@@ -428,6 +860,8 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "L24_format"))sq_conf->L24_format = atol(val);
 	if (!strcmp(name, "flac_header"))sq_conf->flac_header = atol(val);
 	if (!strcmp(name, "upnp_remove_count"))Conf->uPNPRemoveCount = atol(val);
+	if (!strcmp(name, "play_latency")) sq_conf->play_latency = atol(val);
+	if (!strcmp(name, "output_delay")) sq_conf->output_delay = atol(val);
 	if (!strcmp(name, "seek_after_pause")) {
 		Conf->SeekAfterPause = atol(val);
 		sq_conf->seek_after_pause = Conf->SeekAfterPause;
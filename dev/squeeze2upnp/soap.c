@@ -0,0 +1,869 @@
+/*
+ *  Squeeze2upnp - LMS to uPNP gateway
+ *
+ *  Squeezelite : (c) Adrian Smith 2012-2014, triode1@btinternet.com
+ *  Additions & gateway : (c) Philippe 2014, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "squeezedefs.h"
+#if WIN
+#include <sys/timeb.h>
+#define strncasecmp _strnicmp
+#define ERROR_TIMEDOUT WSAETIMEDOUT
+#else
+#define ERROR_TIMEDOUT EWOULDBLOCK
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#endif
+#include "ithread.h"
+#include "squeeze2upnp.h"
+#include "soap.h"
+
+/*
+libupnp opens a new TCP connection for every SOAP request and closes it once
+the answer is received. With several polls per second per renderer, that is a
+lot of handshakes and TIME_WAIT sockets, so control requests are sent here on
+HTTP/1.1 keep-alive connections, pooled per renderer (host:port of control url)
+and served by a few workers. A pooled connection that has been closed by the
+renderer is transparently re-opened once.
+Every request has a deadline. Idempotent ones are re-scheduled with a jittered
+back-off when they could not be sent at all, as long as the deadline allows it.
+A request that has reached the renderer is never re-sent (a late answer to a
+SetURI must not cause a reload), and a delayed one is not overtaken by later
+requests to the same renderer.
+Workers are shared, but a renderer cannot hold more than SOAP_HOST_WORKERS of
+them (and only one for polls), so that a slow one cannot stall the others.
+Commands always go ahead of polls and a slow renderer cannot have more than
+SOAP_WINDOW requests pending: further polls are dropped, as well as polls for
+an action that is already pending (they would return the same thing)
+*/
+#define SOAP_WORKERS		4
+#define SOAP_QUEUE			128
+#define SOAP_WINDOW			4
+#define SOAP_HOSTS			32
+#define SOAP_CNX_PER_HOST	2
+#define SOAP_HOST_WORKERS	SOAP_CNX_PER_HOST
+#define SOAP_TIMEOUT		5000
+#define SOAP_DEADLINE		8000
+#define SOAP_RETRIES		2
+#define SOAP_BACKOFF		200
+#define SOAP_IDLE			30000
+#define SOAP_MAX_RESPONSE	(256*1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+struct sSOAPRequest {
+	struct sSOAPRequest *Next;
+	char 				*ControlURL, *Action;
+	char 				Host[RESOURCE_LENGTH];
+	bool				Poll, Head, Retry;
+	int					Attempt;
+	u64_t				Id;
+	u32_t				Queued, Deadline, NotBefore;
+	struct sockaddr_in	Addr;
+	char 				*Data;
+	Upnp_FunPtr			Callback;
+	void 				*Cookie;
+};
+
+static struct sSOAPHost {
+	char	Host[RESOURCE_LENGTH];
+	u32_t	Last;
+	struct sSOAPCnx {
+		int		Sock;
+		bool	Busy;
+		u32_t	Last;
+	} Cnx[SOAP_CNX_PER_HOST];
+} glHosts[SOAP_HOSTS];
+
+// commands first, then polls
+static struct {
+	struct sSOAPRequest *Head, *Tail;
+} glQueues[2];
+
+static struct sSOAPRequest	*glActive[SOAP_WORKERS];
+static int 					glQueueCount;
+static pthread_t			glWorkers[SOAP_WORKERS];
+static ithread_mutex_t		glSOAPMutex;
+static ithread_cond_t		glSOAPCond;
+static bool					glSOAPRunning;
+static struct sSOAPStats	glStats;
+static log_level			loglevel = lWARN;
+
+static void *SOAPWorker(void *args);
+static void FreeRequest(struct sSOAPRequest *Req);
+
+/*----------------------------------------------------------------------------*/
+void SOAPInit(log_level level)
+{
+	int i, j;
+
+	loglevel = level;
+	memset(glQueues, 0, sizeof(glQueues));
+	memset(glActive, 0, sizeof(glActive));
+	memset(&glStats, 0, sizeof(glStats));
+	glQueueCount = 0;
+
+	memset(glHosts, 0, sizeof(glHosts));
+	for (i = 0; i < SOAP_HOSTS; i++)
+		for (j = 0; j < SOAP_CNX_PER_HOST; j++) glHosts[i].Cnx[j].Sock = -1;
+
+	ithread_mutex_init(&glSOAPMutex, 0);
+	ithread_cond_init(&glSOAPCond, 0);
+	glSOAPRunning = true;
+
+	for (i = 0; i < SOAP_WORKERS; i++) pthread_create(&glWorkers[i], NULL, &SOAPWorker, (void*) (intptr_t) i);
+}
+
+/*----------------------------------------------------------------------------*/
+void SOAPClose(void)
+{
+	struct sSOAPRequest *Req;
+	int i, j;
+
+	if (!glSOAPRunning) return;
+
+	ithread_mutex_lock(&glSOAPMutex);
+	glSOAPRunning = false;
+	ithread_cond_broadcast(&glSOAPCond);
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	for (i = 0; i < SOAP_WORKERS; i++) pthread_join(glWorkers[i], NULL);
+
+	// pending requests are dropped, devices are gone anyway
+	for (i = 0; i < 2; i++)
+		while ((Req = glQueues[i].Head) != NULL) {
+			glQueues[i].Head = Req->Next;
+			FreeRequest(Req);
+		}
+
+	for (i = 0; i < SOAP_HOSTS; i++)
+		for (j = 0; j < SOAP_CNX_PER_HOST; j++)
+			if (glHosts[i].Cnx[j].Sock >= 0) closesocket(glHosts[i].Cnx[j].Sock);
+
+	ithread_cond_destroy(&glSOAPCond);
+	ithread_mutex_destroy(&glSOAPMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+void SOAPStats(struct sSOAPStats *Stats)
+{
+	int i, j;
+
+	ithread_mutex_lock(&glSOAPMutex);
+	*Stats = glStats;
+	Stats->Queued = glQueueCount;
+	for (Stats->Idle = i = 0; i < SOAP_HOSTS; i++)
+		for (j = 0; j < SOAP_CNX_PER_HOST; j++)
+			if (glHosts[i].Cnx[j].Sock >= 0 && !glHosts[i].Cnx[j].Busy) Stats->Idle++;
+	ithread_mutex_unlock(&glSOAPMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void FreeRequest(struct sSOAPRequest *Req)
+{
+	NFREE(Req->ControlURL);
+	NFREE(Req->Action);
+	NFREE(Req->Data);
+	free(Req);
+}
+
+/*----------------------------------------------------------------------------*/
+/* mutex must be locked                                                       */
+static bool DropPoll(struct sSOAPRequest *Req)
+{
+	struct sSOAPRequest *p;
+	int i, Pending = 0;
+	bool Same = false;
+
+	for (i = 0; i < 2; i++)
+		for (p = glQueues[i].Head; p; p = p->Next) {
+			if (strcmp(p->Host, Req->Host)) continue;
+			Pending++;
+			if (p->Poll && !strcmp(p->Action, Req->Action)) Same = true;
+		}
+
+	for (i = 0; i < SOAP_WORKERS; i++) {
+		if (!glActive[i] || strcmp(glActive[i]->Host, Req->Host)) continue;
+		Pending++;
+		if (glActive[i]->Poll && !strcmp(glActive[i]->Action, Req->Action)) Same = true;
+	}
+
+	if (Same) glStats.Collapsed++;
+	else if (Pending >= SOAP_WINDOW) glStats.Dropped++;
+	else return false;
+
+	LOG_DEBUG("[%s]: %s poll dropped (%d pending)", Req->Host, Req->Action, Pending);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool ParseURL(char *URL, char *Host, struct sockaddr_in *Addr, char **Path)
+{
+	char Name[RESOURCE_LENGTH] = "";
+	unsigned Port = 80;
+	char *p;
+
+	if (strncasecmp(URL, "http://", 7)) return false;
+
+	URL += 7;
+	if ((p = strchr(URL, '/')) == NULL) p = URL + strlen(URL);
+	if (p - URL >= RESOURCE_LENGTH) return false;
+
+	strncpy(Host, URL, p - URL);
+	Host[p - URL] = '\0';
+	*Path = *p ? p : "/";
+	sscanf(Host, "%[^:]:%u", Name, &Port);
+
+	memset(Addr, 0, sizeof(struct sockaddr_in));
+	Addr->sin_family = AF_INET;
+	Addr->sin_port = htons(Port);
+	Addr->sin_addr.s_addr = inet_addr(Name);
+
+	if (Addr->sin_addr.s_addr == INADDR_NONE) {
+		struct addrinfo Hints, *Res;
+
+		memset(&Hints, 0, sizeof(Hints));
+		Hints.ai_family = AF_INET;
+		if (getaddrinfo(Name, NULL, &Hints, &Res)) return false;
+		Addr->sin_addr = ((struct sockaddr_in*) Res->ai_addr)->sin_addr;
+		freeaddrinfo(Res);
+	}
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static int Enqueue(struct sSOAPRequest *Req)
+{
+	ithread_mutex_lock(&glSOAPMutex);
+
+	if (!glSOAPRunning || glQueueCount >= SOAP_QUEUE) {
+		ithread_mutex_unlock(&glSOAPMutex);
+		LOG_ERROR("cannot queue %s for %s (%d pending)", Req->Action, Req->ControlURL, glQueueCount);
+		FreeRequest(Req);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	Req->Queued = Req->NotBefore = gettime_ms();
+	Req->Deadline = Req->Queued + SOAP_DEADLINE;
+
+	if (glQueues[Req->Poll].Tail) glQueues[Req->Poll].Tail->Next = Req;
+	else glQueues[Req->Poll].Head = Req;
+	glQueues[Req->Poll].Tail = Req;
+	if (++glQueueCount > glStats.Peak) glStats.Peak = glQueueCount;
+
+	ithread_cond_signal(&glSOAPCond);
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	return UPNP_E_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Body is the serialized action element, it is copied                       */
+int SOAPSendBody(char *ControlURL, char *Service, char *Action, const char *Body,
+				 int Flags, Upnp_FunPtr Callback, u64_t Id)
+{
+	struct sSOAPRequest *Req;
+	char *Path, *Envelope;
+	int len;
+
+	if (!Body || !Callback) return UPNP_E_INVALID_PARAM;
+
+	Req = calloc(1, sizeof(struct sSOAPRequest));
+	if (!ParseURL(ControlURL, Req->Host, &Req->Addr, &Path)) {
+		LOG_ERROR("invalid control url %s", ControlURL);
+		free(Req);
+		return UPNP_E_INVALID_URL;
+	}
+
+	Req->Action = strdup(Action);
+	Req->Poll = (Flags & SOAP_POLL) != 0;
+	Req->Retry = (Flags & SOAP_RETRY) != 0;
+
+	// polls all come from the scheduler, so no need to hold the lock until queued
+	ithread_mutex_lock(&glSOAPMutex);
+	if (Req->Poll && DropPoll(Req)) {
+		ithread_mutex_unlock(&glSOAPMutex);
+		FreeRequest(Req);
+		return UPNP_E_SUCCESS;
+	}
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	Envelope = malloc(strlen(Body) + 256);
+	len = sprintf(Envelope, "<?xml version=\"1.0\"?>\r\n"
+					"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+					"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+					"<s:Body>%s</s:Body></s:Envelope>\r\n", Body);
+
+	Req->Data = malloc(len + strlen(Path) + strlen(Req->Host) + strlen(Service) + strlen(Action) + 256);
+	sprintf(Req->Data, "POST %s HTTP/1.1\r\n"
+					"HOST: %s\r\n"
+					"CONTENT-LENGTH: %d\r\n"
+					"CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n"
+					"SOAPACTION: \"%s#%s\"\r\n"
+					"CONNECTION: keep-alive\r\n\r\n%s",
+					Path, Req->Host, len, Service, Action, Envelope);
+	free(Envelope);
+
+	// callback gets a pointer to the action id as cookie
+	Req->ControlURL = strdup(ControlURL);
+	Req->Callback = Callback;
+	Req->Id = Id;
+	Req->Cookie = &Req->Id;
+
+	return Enqueue(Req);
+}
+
+/*----------------------------------------------------------------------------*/
+int SOAPSendAction(char *ControlURL, char *Service, char *Action, IXML_Document *Doc,
+				   int Flags, Upnp_FunPtr Callback, u64_t Id)
+{
+	char *Body;
+	int rc;
+
+	if (!Doc) return UPNP_E_INVALID_PARAM;
+
+	Body = ixmlPrintNode((IXML_Node*) Doc);
+	rc = SOAPSendBody(ControlURL, Service, Action, Body, Flags, Callback, Id);
+	ixmlFreeDOMString(Body);
+
+	return rc;
+}
+
+/*----------------------------------------------------------------------------*/
+int SOAPProbe(char *URL, Upnp_FunPtr Callback, void *Cookie)
+{
+	struct sSOAPRequest *Req = calloc(1, sizeof(struct sSOAPRequest));
+	char *Path;
+
+	if (!ParseURL(URL, Req->Host, &Req->Addr, &Path)) {
+		free(Req);
+		return UPNP_E_INVALID_URL;
+	}
+
+	// cheapest request a renderer can answer, any answer proves it is alive
+	Req->Data = malloc(strlen(Path) + strlen(Req->Host) + 64);
+	sprintf(Req->Data, "HEAD %s HTTP/1.1\r\nHOST: %s\r\nCONNECTION: keep-alive\r\n\r\n", Path, Req->Host);
+	Req->Action = strdup("HEAD");
+	Req->Head = true;
+	Req->ControlURL = strdup(URL);
+	Req->Callback = Callback;
+	Req->Cookie = Cookie;
+
+	return Enqueue(Req);
+}
+
+/*----------------------------------------------------------------------------*/
+/* returns an idle pooled connection (Sock >= 0) or a free slot (Sock = -1),  */
+/* or NULL if all pooled connections are busy                                 */
+static struct sSOAPCnx *GetCnx(char *Host, int *Sock)
+{
+	struct sSOAPHost *p = NULL, *LRU = NULL;
+	struct sSOAPCnx *Cnx = NULL;
+	u32_t now = gettime_ms();
+	int i, j;
+
+	*Sock = -1;
+	ithread_mutex_lock(&glSOAPMutex);
+
+	for (i = 0; i < SOAP_HOSTS && !p; i++) if (!strcmp(glHosts[i].Host, Host)) p = glHosts + i;
+
+	// new host, take a free entry or recycle the least recently used idle one
+	for (i = 0; i < SOAP_HOSTS && !p; i++) {
+		for (j = 0; j < SOAP_CNX_PER_HOST && !glHosts[i].Cnx[j].Busy; j++);
+		if (j < SOAP_CNX_PER_HOST) continue;
+		if (!*glHosts[i].Host) p = glHosts + i;
+		else if (!LRU || (s32_t) (glHosts[i].Last - LRU->Last) < 0) LRU = glHosts + i;
+	}
+
+	if (!p && LRU) {
+		p = LRU;
+		for (i = 0; i < SOAP_CNX_PER_HOST; i++) {
+			if (p->Cnx[i].Sock >= 0) closesocket(p->Cnx[i].Sock);
+			p->Cnx[i].Sock = -1;
+		}
+	}
+
+	if (p) {
+		strcpy(p->Host, Host);
+		p->Last = now;
+
+		for (i = 0; i < SOAP_CNX_PER_HOST; i++) {
+			if (p->Cnx[i].Busy) continue;
+			// renderers usually drop idle connections after a while
+			if (p->Cnx[i].Sock >= 0 && now - p->Cnx[i].Last > SOAP_IDLE) {
+				closesocket(p->Cnx[i].Sock);
+				p->Cnx[i].Sock = -1;
+			}
+			if (!Cnx || (Cnx->Sock < 0 && p->Cnx[i].Sock >= 0)) Cnx = p->Cnx + i;
+		}
+	}
+
+	if (Cnx) {
+		Cnx->Busy = true;
+		*Sock = Cnx->Sock;
+		if (*Sock >= 0) glStats.Reused++;
+	}
+
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	return Cnx;
+}
+
+/*----------------------------------------------------------------------------*/
+static void ReleaseCnx(struct sSOAPCnx *Cnx, int Sock)
+{
+	if (!Cnx) {
+		if (Sock >= 0) closesocket(Sock);
+		return;
+	}
+
+	ithread_mutex_lock(&glSOAPMutex);
+	Cnx->Sock = Sock;
+	Cnx->Last = gettime_ms();
+	Cnx->Busy = false;
+	ithread_mutex_unlock(&glSOAPMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static int Connect(struct sockaddr_in *Addr)
+{
+	struct timeval tv = { SOAP_TIMEOUT / 1000, (SOAP_TIMEOUT % 1000) * 1000 };
+	int sock, err = 0, one = 1;
+	socklen_t len = sizeof(err);
+	fd_set wfds;
+#if WIN
+	u_long iMode = 1;
+	DWORD timeout = SOAP_TIMEOUT;
+#endif
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) return -1;
+
+#if WIN
+	ioctlsocket(sock, FIONBIO, &iMode);
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+#endif
+
+	connect(sock, (struct sockaddr*) Addr, sizeof(struct sockaddr_in));
+
+	FD_ZERO(&wfds);
+	FD_SET(sock, &wfds);
+	if (select(sock + 1, NULL, &wfds, NULL, &tv) <= 0 ||
+		getsockopt(sock, SOL_SOCKET, SO_ERROR, (void*) &err, &len) || err) {
+		closesocket(sock);
+		return -1;
+	}
+
+	// back to blocking, with i/o timeouts
+#if WIN
+	iMode = 0;
+	ioctlsocket(sock, FIONBIO, &iMode);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*) &timeout, sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*) &timeout, sizeof(timeout));
+#else
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (void*) &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (void*) &tv, sizeof(tv));
+#endif
+#ifdef SO_NOSIGPIPE
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void*) &one, sizeof(one));
+#endif
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void*) &one, sizeof(one));
+
+	ithread_mutex_lock(&glSOAPMutex);
+	glStats.Opened++;
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	return sock;
+}
+
+/*----------------------------------------------------------------------------*/
+/* chunks are decoded in place, returns decoded length or -1 if incomplete    */
+static int Dechunk(char *Body, int len)
+{
+	char *src = Body, *dst = Body, *end = Body + len;
+
+	while (src < end) {
+		char *eol = strstr(src, "\r\n");
+		long size;
+
+		if (!eol) return -1;
+		size = strtol(src, NULL, 16);
+		src = eol + 2;
+
+		// last chunk, then optional trailers up to the final empty line
+		while (!size) {
+			if ((eol = strstr(src, "\r\n")) == NULL) return -1;
+			if (eol == src) return dst - Body;
+			src = eol + 2;
+		}
+
+		if (src + size + 2 > end) return -1;
+		memmove(dst, src, size);
+		dst += size;
+		src += size + 2;
+	}
+
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+static int Exchange(int Sock, char *Data, bool Head, char **Body, int *Status, bool *KeepAlive, bool *Received)
+{
+	int size = 4096, len = 0, Header = 0, Length = -1, n;
+	bool Chunked = false;
+	char *buf, *p;
+
+	*Received = false;
+
+	for (p = Data, n = strlen(Data); n > 0; ) {
+		int sent = send(Sock, p, n, MSG_NOSIGNAL);
+		if (sent <= 0) return UPNP_E_SOCKET_WRITE;
+		p += sent;
+		n -= sent;
+	}
+
+	buf = malloc(size + 1);
+
+	while (1) {
+		if (len == size) {
+			// rest of the response is left unread, connection cannot be re-used
+			if (size >= SOAP_MAX_RESPONSE) {
+				LOG_WARN("response exceeds %d bytes, truncated", SOAP_MAX_RESPONSE);
+				*KeepAlive = false;
+				break;
+			}
+			size *= 2;
+			buf = realloc(buf, size + 1);
+		}
+
+		n = recv(Sock, buf + len, size - len, 0);
+		if (n <= 0) {
+			// a response without length ends when connection is closed
+			if (!n && Header && Length < 0 && !Chunked) break;
+			free(buf);
+			return n < 0 && last_error() == ERROR_TIMEDOUT ? UPNP_E_TIMEDOUT : UPNP_E_SOCKET_READ;
+		}
+
+		*Received = true;
+		len += n;
+		buf[len] = '\0';
+
+		if (!Header) {
+			char *line;
+
+			if ((p = strstr(buf, "\r\n\r\n")) == NULL) continue;
+			Header = p + 4 - buf;
+
+			*KeepAlive = strncasecmp(buf, "HTTP/1.0", 8) != 0;
+			*Status = (p = strchr(buf, ' ')) != NULL ? atoi(p + 1) : 0;
+			if (Head) Length = 0;
+
+			for (line = strstr(buf, "\r\n") + 2; line < buf + Header - 2; line = strstr(line, "\r\n") + 2) {
+				if (!strncasecmp(line, "content-length:", 15)) Length = Head ? 0 : atoi(line + 15);
+				else if (!strncasecmp(line, "transfer-encoding:", 18)) Chunked = strncasecmp(line + 18 + strspn(line + 18, " "), "chunked", 7) == 0;
+				else if (!strncasecmp(line, "connection:", 11)) {
+					p = line + 11 + strspn(line + 11, " ");
+					if (!strncasecmp(p, "close", 5)) *KeepAlive = false;
+					else if (!strncasecmp(p, "keep-alive", 10)) *KeepAlive = true;
+				}
+			}
+		}
+
+		if (Chunked && !Head) {
+			int decoded;
+			char *copy = malloc(len - Header + 1);
+
+			// decoding is destructive, so try on a copy until complete
+			memcpy(copy, buf + Header, len - Header + 1);
+			if ((decoded = Dechunk(copy, len - Header)) >= 0) {
+				copy[decoded] = '\0';
+				free(buf);
+				*Body = copy;
+				return UPNP_E_SUCCESS;
+			}
+			free(copy);
+		} else if (Length >= 0 && len - Header >= Length) {
+			buf[Header + Length] = '\0';
+			break;
+		}
+	}
+
+	// a chunked body only gets here when truncated, it cannot be decoded
+	if (!Header || (Chunked && !Head)) {
+		free(buf);
+		return UPNP_E_BAD_RESPONSE;
+	}
+
+	if (Length < 0) *KeepAlive = false;
+	memmove(buf, buf + Header, len - Header + 1);
+	*Body = buf;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static int Send(struct sSOAPRequest *Req, char **Body, int *Status)
+{
+	struct sSOAPCnx *Cnx;
+	bool KeepAlive = false, Reused, Received;
+	int Sock, rc;
+
+	Cnx = GetCnx(Req->Host, &Sock);
+
+	while (1) {
+		Reused = Sock >= 0;
+		if (!Reused && (Sock = Connect(&Req->Addr)) < 0) {
+			rc = UPNP_E_SOCKET_CONNECT;
+			break;
+		}
+
+		rc = Exchange(Sock, Req->Data, Req->Head, Body, Status, &KeepAlive, &Received);
+
+		if (rc != UPNP_E_SUCCESS) {
+			closesocket(Sock);
+			Sock = -1;
+		}
+
+		// renderer might have closed a kept connection meanwhile, retry once
+		if (rc == UPNP_E_SUCCESS || rc == UPNP_E_TIMEDOUT || !Reused || Received) break;
+		LOG_DEBUG("[%s]: connection lost, re-opening", Req->Host);
+	}
+
+	if (Sock >= 0 && !KeepAlive) {
+		closesocket(Sock);
+		Sock = -1;
+	}
+
+	ReleaseCnx(Cnx, Sock);
+
+	return rc;
+}
+
+/*----------------------------------------------------------------------------*/
+static void Latency(char *Action, u32_t Elapsed)
+{
+	static const u32_t Bounds[SOAP_BUCKETS - 1] = SOAP_BOUNDS;
+	struct sSOAPLatency *p = NULL;
+	int i;
+
+	ithread_mutex_lock(&glSOAPMutex);
+
+	for (i = 0; i < SOAP_ACTIONS && !p; i++) {
+		if (!*glStats.Latency[i].Action) strncpy(glStats.Latency[i].Action, Action, sizeof(glStats.Latency[i].Action) - 1);
+		if (!strcmp(glStats.Latency[i].Action, Action)) p = glStats.Latency + i;
+	}
+
+	if (p) {
+		for (i = 0; i < SOAP_BUCKETS - 1 && Elapsed >= Bounds[i]; i++);
+		p->Buckets[i]++;
+		p->Count++;
+		if (Elapsed > p->Max) p->Max = Elapsed;
+	}
+
+	ithread_mutex_unlock(&glSOAPMutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/* returns true when request has been re-scheduled and must be queued again   */
+static bool Process(struct sSOAPRequest *Req)
+{
+	struct Upnp_Action_Complete Event;
+	int Status = 0, rc;
+	char *Body = NULL;
+
+	// a command that waited too long in the queue is not worth sending
+	if ((s32_t) (gettime_ms() - Req->Deadline) >= 0) rc = UPNP_E_TIMEDOUT;
+	else rc = Send(Req, &Body, &Status);
+
+	// only what the renderer cannot have received is worth sending again
+	if (Req->Retry && Req->Attempt < SOAP_RETRIES &&
+		(rc == UPNP_E_SOCKET_CONNECT || rc == UPNP_E_SOCKET_WRITE)) {
+		// back-off with jitter, so that renderers are not hammered in sync
+		u32_t Wait = (SOAP_BACKOFF << Req->Attempt) + rand() % SOAP_BACKOFF;
+
+		if ((s32_t) (gettime_ms() + Wait - Req->Deadline) < 0) {
+			LOG_INFO("[%s]: %s failed %d, retrying in %u ms", Req->Host, Req->Action, rc, Wait);
+			Req->Attempt++;
+			Req->NotBefore = gettime_ms() + Wait;
+			return true;
+		}
+	}
+
+	Latency(Req->Action, gettime_ms() - Req->Queued);
+
+	memset(&Event, 0, sizeof(Event));
+	strncpy(Event.CtrlUrl, Req->ControlURL, NAME_SIZE - 1);
+
+	if (rc == UPNP_E_SUCCESS && !Req->Head) {
+		Event.ActionResult = ixmlParseBuffer(Body);
+		// SOAP faults are reported with their UPnP error code, like libupnp does
+		if (Status != 200) {
+			char *p = strstr(Body, "errorCode>");
+			rc = p ? atoi(p + 10) : 0;
+			if (rc <= 0) rc = UPNP_E_BAD_RESPONSE;
+		}
+	}
+
+	if (rc != UPNP_E_SUCCESS) {
+		LOG_INFO("[%s]: SOAP request failed %d (http %d)", Req->Host, rc, Status);
+	}
+
+	Event.ErrCode = rc;
+	Req->Callback(UPNP_CONTROL_ACTION_COMPLETE, &Event, Req->Cookie);
+
+	if (Event.ActionResult) ixmlDocument_free(Event.ActionResult);
+	NFREE(Body);
+
+	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+/* mutex must be locked                                                       */
+static int Active(char *Host, bool Poll)
+{
+	int i, n = 0;
+
+	for (i = 0; i < SOAP_WORKERS; i++)
+		if (glActive[i] && (!Poll || glActive[i]->Poll) && !strcmp(glActive[i]->Host, Host)) n++;
+
+	return n;
+}
+
+/* mutex must be locked. Takes the first request that is due and whose        */
+/* renderer is below its share of workers, but never one that would overtake  */
+/* a delayed request to the same renderer                                     */
+static struct sSOAPRequest *Dequeue(u32_t *Wait)
+{
+	char *Delayed[SOAP_QUEUE];
+	u32_t now = gettime_ms();
+	int i, j, n = 0;
+
+	*Wait = 0;
+
+	for (i = 0; i < 2; i++) {
+		struct sSOAPRequest *p, *Prev = NULL;
+
+		for (p = glQueues[i].Head; p; Prev = p, p = p->Next) {
+			s32_t Due = p->NotBefore - now;
+
+			for (j = 0; j < n && strcmp(Delayed[j], p->Host); j++);
+			if (j < n) continue;
+
+			if (Due > 0) {
+				if (n < SOAP_QUEUE) Delayed[n++] = p->Host;
+				if (!*Wait || (u32_t) Due < *Wait) *Wait = Due;
+				continue;
+			}
+
+			// busy renderer, its request will be taken when a worker is released
+			if (Active(p->Host, false) >= SOAP_HOST_WORKERS || (p->Poll && Active(p->Host, true))) continue;
+
+			if (Prev) Prev->Next = p->Next;
+			else glQueues[i].Head = p->Next;
+			if (glQueues[i].Tail == p) glQueues[i].Tail = Prev;
+			p->Next = NULL;
+			glQueueCount--;
+
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* mutex must be locked, a re-scheduled request keeps its place in the queue  */
+static void Requeue(struct sSOAPRequest *Req)
+{
+	Req->Next = glQueues[Req->Poll].Head;
+	glQueues[Req->Poll].Head = Req;
+	if (!glQueues[Req->Poll].Tail) glQueues[Req->Poll].Tail = Req;
+	glQueueCount++;
+}
+
+/*----------------------------------------------------------------------------*/
+/* mutex must be locked                                                       */
+static void WaitDue(u32_t ms)
+{
+	struct timespec ts;
+#if WIN
+	struct _timeb tb;
+
+	_ftime(&tb);
+	ts.tv_sec = tb.time + ms / 1000;
+	ts.tv_nsec = (tb.millitm + ms % 1000) * 1000000L;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + ms / 1000;
+	ts.tv_nsec = (tv.tv_usec + (ms % 1000) * 1000) * 1000L;
+#endif
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	ithread_cond_timedwait(&glSOAPCond, &glSOAPMutex, &ts);
+}
+
+/*----------------------------------------------------------------------------*/
+static void *SOAPWorker(void *args)
+{
+	int Worker = (intptr_t) args;
+	struct sSOAPRequest *Req;
+
+	ithread_mutex_lock(&glSOAPMutex);
+
+	while (glSOAPRunning) {
+		u32_t Wait;
+		bool Again;
+
+		if ((Req = Dequeue(&Wait)) == NULL) {
+			// only delayed requests left, wake up when first one is due
+			if (Wait) WaitDue(Wait);
+			else ithread_cond_wait(&glSOAPCond, &glSOAPMutex);
+			continue;
+		}
+
+		glActive[Worker] = Req;
+		ithread_mutex_unlock(&glSOAPMutex);
+
+		Again = Process(Req);
+
+		ithread_mutex_lock(&glSOAPMutex);
+		glActive[Worker] = NULL;
+		if (Again) Requeue(Req);
+		else FreeRequest(Req);
+
+		// this renderer might have requests that were held back
+		ithread_cond_broadcast(&glSOAPCond);
+	}
+
+	ithread_mutex_unlock(&glSOAPMutex);
+
+	return NULL;
+}
@@ -36,6 +36,7 @@
 #include "util.h"
 #include "avt_util.h"
 #include "mr_util.h"
+#include "soap.h"
 
 /*
 TODO :
@@ -43,6 +44,17 @@ TODO :
 - samplerate management will have to be reviewed when decode will be used
 */
 
+#define TRACK_POLL (1000)
+#define STATE_POLL (500)
+#define STATE_POLL_EVENT (10000)
+#define TRANSITION_POLL (250)
+#define IDLE_POLL (2000)
+#define MAX_ACTION_ERRORS (5)
+#define VOLUME_INTERVAL (200)
+#define PROBE_MIN (2000)
+#define PROBE_MAX (60000)
+#define DESC_WORKERS (8)
+
 /*----------------------------------------------------------------------------*/
 /* globals initialized */
 /*----------------------------------------------------------------------------*/
@@ -85,14 +97,16 @@ sq_dev_param_t glDeviceParam = {
 						SQ_RATE_12000, SQ_RATE_11025, SQ_RATE_8000, 0 },
 					-1,
 					100,
-					"mp3",
+					"pcm,flc,mp3,aac,ogg,wma,alc",
 					SQ_RATE_48000,
 					L24_PACKED_LPCM,
 					FLAC_NORMAL_HEADER,
 					".",
 					-1L,
 					0,
-					{ 0x00,0x00,0x00,0x00,0x00,0x00 }
+					{ 0x00,0x00,0x00,0x00,0x00,0x00 },
+					0,
+					0
 				} ;
 
 /*----------------------------------------------------------------------------*/
@@ -105,11 +119,15 @@ char 				glIPaddress[128] = "";
 UpnpClient_Handle 	glControlPointHandle;
 void				*glConfigID = NULL;
 char				glConfigName[SQ_STR_LENGTH] = "./config.xml";
+static char			glCacheName[SQ_STR_LENGTH];
+static pthread_t	glValidateThread;
+static bool			glValidating = false;
 static bool			glDiscovery = false;
 u32_t				gluPNPScanInterval = SCAN_INTERVAL;
 u32_t				gluPNPScanTimeout = SCAN_TIMEOUT;
 struct sMR			glMRDevices[MAX_RENDERERS];
 ithread_mutex_t		glMRFoundMutex;
+static ithread_mutex_t	glMRAddMutex;
 
 /*----------------------------------------------------------------------------*/
 /* consts or pseudo-const*/
@@ -133,7 +151,8 @@ static log_level 	loglevel = lWARN;
 ithread_t			glUpdateMRThread;
 static bool			glMainRunning = true;
 static struct sLocList {
-	char 			*Location;
+	char 			*Location;
+	char			*UDN;
 	struct sLocList *Next;
 } *glMRFoundList = NULL;
 
@@ -141,7 +160,7 @@ static struct sLocList {
 			VERSION "\n"
 		   "See -t for license terms\n"
 		   "Usage: [options]\n"
-		   "  -s <server>[:<port>]\tConnect to specified server, otherwise uses autodiscovery to find server\n"
+		   "  -s <server>[:<port>][,<server>[:<port>]]\tConnect to specified server (others are failover), otherwise uses autodiscovery to find server\n"
 		   "  -x <config file>\tread config from file (default is ./config.xml)\n"
    		   "  -i <config file>\tdiscover players, save config in <file> and then exit\n"
 //		   "  -c <codec1>,<codec2>\tRestrict codecs to those specified, otherwise load all available codecs; known codecs: " CODECS "\n"
@@ -227,12 +246,30 @@ static char license[] =
 /*----------------------------------------------------------------------------*/
 /* prototypes */
 /*----------------------------------------------------------------------------*/
-static void *MRThread(void *args);
+static void ScheduleDevice(struct sMR *Device, u32_t Delay);
+static void OpenBreaker(struct sMR *Device);
+static void SendVolume(struct sMR *Device);
+static u8_t Gain2Volume(struct sMR *Device, u32_t Gain);
+static void CloseBreaker(struct sMR *Device);
 static void *UpdateMRThread(void *args);
-static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,	const char *location);
+static bool RefreshTO(char *UDN);
+static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,	const char *location, u8_t *CachedMac);
+static void UpdateCodecs(struct sMR *Device);
 
-/*----------------------------------------------------------------------------*/
-bool sq_callback(sq_dev_handle_t handle, void *caller, sq_action_t action, u8_t *cookie, void *param)
+/*----------------------------------------------------------------------------*/
+static void ProxyArtwork(sq_metadata_t *MetaData)
+{
+	char *Artwork = ArtworkProxy(MetaData->artwork);
+
+	// players get the cover from us, not from LMS
+	if (Artwork) {
+		free(MetaData->artwork);
+		MetaData->artwork = Artwork;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+bool sq_callback(sq_dev_handle_t handle, void *caller, sq_action_t action, u8_t *cookie, void *param)
 {
 	struct sMR *device = caller;
 	char *p = (char*) param;
@@ -246,6 +283,8 @@ static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,
 	if (action == SQ_ONOFF) {
 		device->on = *((bool*) param);
 		LOG_DEBUG("[%p]: device set on/off %d", caller, device->on);
+		// jobs disarm themselves when off
+		if (device->on) ScheduleDevice(device, 0);
 	}
 
 	if (!device->on) {
@@ -284,6 +323,7 @@ static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,
 			strcpy(device->NextProtInfo, p->proto_info);
 			if (device->Config.SendMetaData) {
 				sq_get_metadata(device->SqueezeHandle, &device->NextMetaData, true);
+				ProxyArtwork(&device->NextMetaData);
 				p->file_size = device->NextMetaData.file_size ?
 							   device->NextMetaData.file_size : device->Config.StreamLength;
 			}
@@ -294,7 +334,7 @@ static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,
 
 			if (device->Config.AcceptNextURI){
 				AVTSetNextURI(device->Service[AVT_SRV_IDX].ControlURL, uri, p->proto_info,
-							  &device->NextMetaData, device->seqN++);
+							  &device->NextMetaData, ++device->ActionId);
 				sq_free_metadata(&device->NextMetaData);
 			}
 
@@ -323,13 +363,14 @@ static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,
 
 			if (device->Config.SendMetaData) {
 				sq_get_metadata(device->SqueezeHandle, &MetaData, false);
+				ProxyArtwork(&MetaData);
 				p->file_size = MetaData.file_size ? MetaData.file_size : device->Config.StreamLength;
 			}
 			else {
 				sq_default_metadata(&MetaData, true);
 				p->file_size = device->Config.StreamLength;
 			}
-			AVTSetURI(device->Service[AVT_SRV_IDX].ControlURL, uri, p->proto_info, &MetaData, device->seqN++);
+			AVTSetURI(device->Service[AVT_SRV_IDX].ControlURL, uri, p->proto_info, &MetaData, ++device->ActionId);
 			sq_free_metadata(&MetaData);
 
 			device->CurrentURI = (char*) malloc(strlen(uri) + 1);
@@ -339,67 +380,64 @@ static bool AddMRDevice(struct sMR *Device, char * UDN, IXML_Document *DescDoc,
 			break;
 		}
 		case SQ_UNPAUSE:
-			if (device->Config.SeekAfterPause == 1) {
-				u32_t PausedTime = sq_get_time(device->SqueezeHandle);
-				sq_set_time(device->SqueezeHandle, PausedTime);
-			}
+			// Play comes back as SQ_PLAY once LMS has answered the seek (or failed to)
+			if (device->Config.SeekAfterPause == 1 && sq_seek_resume(device->SqueezeHandle)) break;
 		case SQ_PLAY:
 			if (device->CurrentURI) {
-				QueueAction(handle, caller, action, cookie, param, false);
+				QueueAction(handle, caller, action, 0, param, false);
 				device->sqState = SQ_PLAY;
-				if (device->Config.VolumeOnPlay == 1)
-					SetVolume(device->Service[REND_SRV_IDX].ControlURL, device->Volume, device->seqN++);
+				if (device->Config.VolumeOnPlay == 1) SendVolume(device);
 			}
 			else rc = false;
 			break;
 		case SQ_STOP:
-			AVTBasic(device->Service[AVT_SRV_IDX].ControlURL, "Stop", device->seqN++);
+			AVTBasic(device->Service[AVT_SRV_IDX].ControlURL, "Stop", ++device->ActionId);
 			NFREE(device->CurrentURI);
 			NFREE(device->NextURI);
 			FlushActionList(device);
 			device->sqState = action;
 			break;
 		case SQ_PAUSE:
-			QueueAction(handle, caller, action, cookie, param, false);
+			QueueAction(handle, caller, action, 0, param, false);
 			device->sqState = action;
 			break;
 		case SQ_SEEK:
 //			AVTSeek(device->Service[AVT_SRV_IDX].ControlURL, *(u16_t*) p);
 			break;
-		case SQ_VOLUME: {
-			u32_t Volume = *(u32_t*)p;
-			int i = 0;
-			s32_t a2, b2, a1 = 0, b1 = 0;
+		case SQ_CALIBRATE: {
+			sq_dev_param_t *p = (sq_dev_param_t*) param;
 
+			// kept in device config so that it survives a "save"
+			device->sq_config.play_latency = p->play_latency;
+			device->sq_config.output_delay = p->output_delay;
+			LOG_INFO("[%p]: calibration latency:%u delay:%u", device, p->play_latency, p->output_delay);
+			break;
+		}
+		case SQ_VOLUME:
 			if (device->Config.VolumeOnPlay == -1) break;
 
-			for (i = 0; i < 32 && Volume > device->VolumeCurve[i].a; i++);
-
-			a1 = (i) ? device->VolumeCurve[i-1].a : 0;
-			b1 = (i) ? device->VolumeCurve[i-1].b : 0;
-			a2 = device->VolumeCurve[i].a;
-			b2 = device->VolumeCurve[i].b;
-			// volume and a are 16 bits, b are 8, so 7 bits precision can be added
-			if (a2) device->Volume = (((s32_t)Volume*(b1-b2)*128)/(a1-a2) + b1*128 - (a1*(b1-b2)*128)/(a1-a2)) / 128;
-			else device->Volume = 0;
-
-			if (!device->Config.VolumeOnPlay || device->sqState == SQ_PLAY)
-				SetVolume(device->Service[REND_SRV_IDX].ControlURL, device->Volume, device->seqN++);
+			device->Volume = Gain2Volume(device, *(u32_t*) p);
+			if (!device->Config.VolumeOnPlay || device->sqState == SQ_PLAY) SendVolume(device);
 			break;
-		}
 		default:
 			break;
 	}
 
+	// state is about to change, do not wait for an idle poll
+	if (action == SQ_PLAY || action == SQ_UNPAUSE || action == SQ_PAUSE || action == SQ_STOP) {
+		ScheduleJob(device->Jobs + STATE_JOB, STATE_POLL);
+		ScheduleJob(device->Jobs + POSITION_JOB, TRACK_POLL);
+	}
+
 	ithread_mutex_unlock(&device->Mutex);
 	return rc;
 }
 
 
 /*----------------------------------------------------------------------------*/
-void SyncNotifState(char *State, struct sMR* Device)
+void SyncNotifState(const char *State, struct sMR* Device)
 {
-	struct sAction *Action = NULL;
+	struct sAction Pending, *Action = NULL;
 	sq_event_t Event = SQ_NONE;
 	bool Param = false;
 
@@ -414,17 +452,18 @@ void SyncNotifState(char *State, struct sMR* Device)
 			LOG_INFO("%s: uPNP transition", Device->FriendlyName);
 		}
 		Device->State = TRANSITIONING;
+		ScheduleJob(Device->Jobs + STATE_JOB, TRANSITION_POLL);
 		ithread_mutex_unlock(&Device->Mutex);
 		return;
 	}
 
-	Action = UnQueueAction(Device, true);
+	if (UnQueueAction(Device, &Pending, true)) Action = &Pending;
 
 	if (!strcmp(State, "STOPPED")) {
 		if (Device->State != STOPPED) {
 			LOG_INFO("%s: uPNP stop", Device->FriendlyName);
 			if (Device->NextURI && !Device->Config.AcceptNextURI) {
-				u8_t *WaitFor = Device->seqN++;
+				u64_t WaitFor = ++Device->ActionId;
 
 				// fake a "SETURI" and a "PLAY" request
 				NFREE(Device->CurrentURI);
@@ -432,16 +471,17 @@ void SyncNotifState(char *State, struct sMR* Device)
 				strcpy(Device->CurrentURI, Device->NextURI);
 				NFREE(Device->NextURI);
 
-				AVTSetURI(Device->Service[AVT_SRV_IDX].ControlURL, Device->CurrentURI,
-						  Device->NextProtInfo, &Device->NextMetaData, WaitFor);
-				sq_free_metadata(&Device->NextMetaData);
-
 				/*
 				Need to queue to wait for the SetURI to be accepted, otherwise
-				the current URI will be played, creating a "blurb" effect
+				the current URI will be played, creating a "blurb" effect. It
+				is queued first so that an early answer cannot be missed
 				*/
 				QueueAction(Device->SqueezeHandle, Device, SQ_PLAY, WaitFor, NULL, true);
 
+				AVTSetURI(Device->Service[AVT_SRV_IDX].ControlURL, Device->CurrentURI,
+						  Device->NextProtInfo, &Device->NextMetaData, WaitFor);
+				sq_free_metadata(&Device->NextMetaData);
+
 				Event = SQ_TRACK_CHANGE;
 				LOG_INFO("[%p]: no gapless %s", Device, Device->CurrentURI);
 			}
@@ -478,15 +518,15 @@ void SyncNotifState(char *State, struct sMR* Device)
 			}
 
 			if (Device->Config.VolumeOnPlay != -1 && Device->Config.ForceVolume == 1 && Device->Config.ProcessMode != SQ_LMSUPNP)
-					SetVolume(Device->Service[REND_SRV_IDX].ControlURL, Device->Volume, Device->seqN++);
+				SendVolume(Device);
 
 			Device->State = PLAYING;
 		}
 
 		// avoid double play (causes a restart) in case of unsollicited play
 		if (Action && (Action->Action == SQ_PLAY || Action->Action == SQ_UNPAUSE)) {
-			UnQueueAction(Device, false);
-			NFREE(Action);
+			UnQueueAction(Device, NULL, false);
+			Action = NULL;
 		}
 	}
 
@@ -499,32 +539,38 @@ void SyncNotifState(char *State, struct sMR* Device)
 			}
 			LOG_INFO("%s: uPNP pause", Device->FriendlyName);
 			if (Action && Action->Action == SQ_PAUSE) {
-				UnQueueAction(Device, false);
-				NFREE(Action);
+				UnQueueAction(Device, NULL, false);
+				Action = NULL;
 			}
 			Device->State = PAUSED;
 		}
 	}
 
-	if (Action && (!Action->Ordered || Action->Cookie <= Device->LastAckAction)) {
-		struct sAction *p = UnQueueAction(Device, false);
-
-		if (p != Action) {
-			LOG_ERROR("[%p]: mutex issue %p, %p", p->Cookie, Action->Cookie);
-		}
+	// an action waiting for an answer that never comes is executed anyway
+	if (Action && Action->Ordered && !Action->Acked &&
+		(s32_t) (gettime_ms() - Action->Deadline) >= 0) {
+		LOG_WARN("[%p]: action %llu not acknowledged in time", Device, (unsigned long long) Action->WaitFor);
+		Action->Ordered = false;
+	}
+
+	if (Action && (!Action->Ordered || Action->Acked)) {
+		struct sAction p;
+
+		if (!UnQueueAction(Device, &p, false) || p.Action != Action->Action || p.WaitFor != Action->WaitFor) {
+			LOG_ERROR("[%p]: mutex issue on action %d", Device, Action->Action);
+		}
 
 		switch (Action->Action) {
 		case SQ_UNPAUSE:
 		case SQ_PLAY:
-			AVTPlay(Action->Caller->Service[AVT_SRV_IDX].ControlURL, Device->seqN++);
+			AVTPlay(Action->Caller->Service[AVT_SRV_IDX].ControlURL, ++Device->ActionId);
 			break;
 		case SQ_PAUSE:
-			AVTBasic(Action->Caller->Service[AVT_SRV_IDX].ControlURL, "Pause", Device->seqN++);
+			AVTBasic(Action->Caller->Service[AVT_SRV_IDX].ControlURL, "Pause", ++Device->ActionId);
 			break;
 		default:
 			break;
 		}
-		NFREE(Action);
 	}
 
 	ithread_mutex_unlock(&Device->Mutex);
@@ -537,51 +583,138 @@ void SyncNotifState(char *State, struct sMR* Device)
 		sq_notify(Device->SqueezeHandle, Device, Event, NULL, &Param);
 }
 
-#ifdef SUBSCRIBE_EVENT
-/*----------------------------------------------------------------------------*/
-void HandleStateEvent(struct Upnp_Event *Event, void *Cookie)
-{
-	struct sMR *Device;
-	IXML_Document *StateDoc, *VarDoc = Event->ChangedVariables;
-	char  *State = NULL;
-	char  *LastChange = NULL;
-	char  *CurrentURI;
-
-	Device = Sid2Device(Event->Sid);
-	if (!Device) {
-		LOG_SDEBUG("no Squeeze device (yet) for %s", Event->Sid);
-		return;
-	}
-
-	if (Device->Magic != MAGIC) {
-		LOG_ERROR("[%p]: Wrong magic ", Device);
+/*----------------------------------------------------------------------------*/
+void SyncNotifURI(const char *URI, struct sMR* Device)
+{
+	if (!Device->CurrentURI) return;
+
+	// mutex has to be set BEFORE test and unset BEFORE notification
+	ithread_mutex_lock(&Device->Mutex);
+	/*
+	an URI change detection is only valid if there is a nextURI
+	pending, otherwise this is false alarm due to de-sync between
+	the two players
+	*/
+	if (Device->CurrentURI && strcmp(URI, Device->CurrentURI) && (Device->State == PLAYING) && Device->NextURI) {
+		LOG_INFO("Detected URI change %s %s", Device->CurrentURI, URI);
+		NFREE(Device->CurrentURI);
+		NFREE(Device->NextURI);
+		Device->CurrentURI = malloc(strlen(URI) + 1);
+		strcpy(Device->CurrentURI, URI);
+		ithread_mutex_unlock(&Device->Mutex);
+		sq_notify(Device->SqueezeHandle, Device, SQ_TRACK_CHANGE, NULL, NULL);
+	}
+	else ithread_mutex_unlock(&Device->Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+void HandleStateEvent(struct Upnp_Event *Event, void *Cookie)
+{
+	struct sMR *Device;
+	IXML_Document *VarDoc = Event->ChangedVariables;
+	char  *r;
+
+	Device = SID2Device(Event->Sid);
+	if (!Device) {
+		LOG_SDEBUG("no Squeeze device (yet) for %s", Event->Sid);
 		return;
-	}
+	}
 
-	if (!Device->on) {
-		LOG_INFO("[%p]: device off, ignored ", Device);
+	if (Device->Magic != MAGIC) {
+		LOG_ERROR("[%p]: Wrong magic ", Device);
 		return;
-	}
+	}
 
-	LastChange = XMLGetFirstDocumentItem(VarDoc, "LastChange");
-	LOG_SDEBUG("Data event %s %u %s", Event->Sid, Event->EventKey, LastChange);
-	if (LastChange) free(LastChange);
-
-	State = XMLGetChangeItem(VarDoc, "TransportState");
-	if (State){
-		SyncNotifState(State, Device);
-		free(State);
-	}
+	if (!Device->on) {
+		LOG_DEBUG("[%p]: device off, ignored ", Device);
+		return;
+	}
 
-	CurrentURI = XMLGetChangeItem(VarDoc, "CurrentTrackURI");
-	if (CurrentURI) {
-		SyncNotifURI(CurrentURI, Device);
-		free(CurrentURI);
-	 }
+	LOG_SDEBUG("[%p]: event %s %u", Device, Event->Sid, Event->EventKey);
 
-	UnQueueAction(Device, false);
-}
-#endif
+	// rendering control only tells about volume, LMS is not informed of that
+	if (!strcmp(Event->Sid, Device->Service[REND_SRV_IDX].SID)) {
+		r = XMLGetChangeItem(VarDoc, "Volume");
+		if (r) LOG_DEBUG("[%p]: renderer volume %s", Device, r);
+		NFREE(r);
+		return;
+	}
+
+	r = XMLGetChangeItem(VarDoc, "TransportState");
+	if (r) {
+		ithread_mutex_lock(&Device->Mutex);
+		if (!Device->Eventing) LOG_INFO("[%p]: eventing confirmed", Device);
+		Device->Eventing = true;
+		ithread_mutex_unlock(&Device->Mutex);
+		SyncNotifState(r, Device);
+	}
+	NFREE(r);
+
+	// some renderers event state but not URI, so this is confirmed separately
+	r = XMLGetChangeItem(VarDoc, "AVTransportURI");
+	if (r) {
+		ithread_mutex_lock(&Device->Mutex);
+		if (!Device->EventingURI) LOG_INFO("[%p]: URI eventing confirmed", Device);
+		Device->EventingURI = true;
+		ithread_mutex_unlock(&Device->Mutex);
+		SyncNotifURI(r, Device);
+	}
+	NFREE(r);
+}
+
+/*----------------------------------------------------------------------------*/
+/* takes glMRAddMutex, so it must not be locked by caller                     */
+static bool Subscribe(struct sMR *Device, struct sService *Service)
+{
+	char UDN[RESOURCE_LENGTH];
+	Upnp_SID SID = "";
+	int TO = SUBSCRIBE_TIMEOUT, rc;
+	bool Valid;
+
+	if (!*Service->EventURL) return false;
+	strcpy(UDN, Device->UDN);
+
+	// libupnp renews the subscription by itself before it expires
+	rc = UpnpSubscribe(glControlPointHandle, Service->EventURL, &TO, SID);
+
+	// that is a round trip, renderer might have been removed meanwhile
+	ithread_mutex_lock(&glMRAddMutex);
+	if ((Valid = Device->InUse && !strcmp(Device->UDN, UDN)) == true) {
+		strcpy(Service->SID, rc == UPNP_E_SUCCESS ? SID : "");
+		Service->TO = TO;
+	}
+	ithread_mutex_unlock(&glMRAddMutex);
+
+	if (rc != UPNP_E_SUCCESS) {
+		LOG_WARN("[%p]: cannot subscribe to %s (rc:%d), polling only", Device, Service->EventURL, rc);
+		return false;
+	}
+
+	if (!Valid) {
+		UpnpUnSubscribeAsync(glControlPointHandle, SID, CallbackEventHandler, NULL);
+		return false;
+	}
+
+	LOG_INFO("[%p]: subscribed to %s (sid:%s to:%d)", Device, Service->Type, Service->SID, Service->TO);
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* slot must be reserved but glMRAddMutex not locked, as subscribing is slow  */
+static void SubscribeMRDevice(struct sMR *Device)
+{
+	if (!*Device->Service[AVT_SRV_IDX].SID) Subscribe(Device, Device->Service + AVT_SRV_IDX);
+	if (!*Device->Service[REND_SRV_IDX].SID) Subscribe(Device, Device->Service + REND_SRV_IDX);
+}
+
+/*----------------------------------------------------------------------------*/
+/* re-subscribes lost services, libupnp callbacks must not wait for that     */
+static u32_t SubscribeJob(struct sMR *p)
+{
+	SubscribeMRDevice(p);
+
+	return 0;
+}
 
 /*----------------------------------------------------------------------------*/
 int CallbackActionHandler(Upnp_EventType EventType, void *Event, void *Cookie)
@@ -592,60 +725,47 @@ int CallbackActionHandler(Upnp_EventType EventType, void *Event, void *Cookie)
 		case UPNP_CONTROL_ACTION_COMPLETE: 	{
 			struct Upnp_Action_Complete *Action = (struct Upnp_Action_Complete *)Event;
 			struct sMR *p;
-			char   *r;
+			u64_t Id;
+			const char *Items[] = { "RelTime", "CurrentTransportState", "CurrentURI" };
+			const char *Values[3];
 
 			p = CURL2Device(Action->CtrlUrl);
 			if (!p) break;
 
-			p->LastAckAction = Cookie;
-			LOG_SDEBUG("[%p]: ac %i %s (cookie %p)", p, EventType, Action->CtrlUrl, Cookie);
+			// an ordered action waits for this very id, not for a later one
+			Id = *((u64_t*) Cookie);
+			AckAction(p, Id);
+			LOG_SDEBUG("[%p]: ac %i %s (id %llu)", p, EventType, Action->CtrlUrl, (unsigned long long) Id);
+
+			// all fields at once, values belong to ActionResult
+			XMLGetItems(Action->ActionResult, Items, Values, 3);
 
 			// time position response
-			r = XMLGetFirstDocumentItem(Action->ActionResult, "RelTime");
-			if (r) {
-				p->Elapsed = Time2Int(r);
-				LOG_SDEBUG("[%p]: position %d (cookie %p)", p, p->Elapsed, Cookie);
+			if (Values[0]) {
+				p->Elapsed = Time2Int(Values[0]);
+				LOG_SDEBUG("[%p]: position %d (id %llu)", p, p->Elapsed, (unsigned long long) Id);
 				// discard any time info unless we are confirmed playing
 				if (p->State == PLAYING)
 					sq_notify(p->SqueezeHandle, p, SQ_TIME, NULL, &p->Elapsed);
 			}
-			NFREE(r);
 
 			// transport state response
-			r = XMLGetFirstDocumentItem(Action->ActionResult, "CurrentTransportState");
-			if (r) SyncNotifState(r, p);
-			NFREE(r);
+			if (Values[1]) SyncNotifState(Values[1], p);
 
 			// URI detection response
-			r = XMLGetFirstDocumentItem(Action->ActionResult, "CurrentURI");
-			if (r && p->CurrentURI) {
-				// mutex has to be set BEFORE test and unset BEFORE notification
-				ithread_mutex_lock(&p->Mutex);
-				/*
-				an URI change detection is only valid if there is a nextURI
-				pending, otherwise this is false alarm due to de-sync between
-				the two players
-				*/
-				if (strcmp(r, p->CurrentURI) && (p->State == PLAYING) && p->NextURI) {
-					LOG_INFO("Detected URI change %s %s", p->CurrentURI, r);
-					NFREE(p->CurrentURI);
-					NFREE(p->NextURI);
-					p->CurrentURI = malloc(strlen(r) + 1);
-					strcpy(p->CurrentURI, r);
-					ithread_mutex_unlock(&p->Mutex);
-					sq_notify(p->SqueezeHandle, p, SQ_TRACK_CHANGE, NULL, NULL);
-				}
-				else ithread_mutex_unlock(&p->Mutex);
-			}
-			NFREE(r);
+			if (Values[2]) SyncNotifURI(Values[2], p);
 
-			LOG_SDEBUG("Action complete : %i (cookie %p)", EventType, Cookie);
+			LOG_SDEBUG("Action complete : %i (id %llu)", EventType, (unsigned long long) Id);
 
 			if (Action->ErrCode != UPNP_E_SUCCESS) {
 				p->ErrorCount++;
-				LOG_ERROR("Error in action callback -- %d (cookie %p)",	Action->ErrCode, Cookie);
+				LOG_ERROR("Error in action callback -- %d (id %llu)", Action->ErrCode, (unsigned long long) Id);
+				// a failed trial re-opens at once
+				if (p->Breaker == BREAKER_HALF || p->ErrorCount > MAX_ACTION_ERRORS) OpenBreaker(p);
+			} else {
+				p->ErrorCount = 0;
+				if (p->Breaker == BREAKER_HALF) CloseBreaker(p);
 			}
-			else p->ErrorCount = 0;
 			break;
 		}
 		default:
@@ -666,24 +786,29 @@ int CallbackEventHandler(Upnp_EventType EventType, void *Event, void *Cookie)
 		break;
 		case UPNP_DISCOVERY_SEARCH_RESULT: {
 			struct Upnp_Discovery *d_event = (struct Upnp_Discovery *) Event;
-			struct sLocList **p, *prev = NULL;
-
-			LOG_DEBUG("Answer to uPNP search %d", d_event->Location);
-			if (d_event->ErrCode != UPNP_E_SUCCESS) {
-				LOG_DEBUG("Error in Discovery Callback -- %d", d_event->ErrCode);
+			struct sLocList **p;
+
+			LOG_DEBUG("Answer to uPNP search %d", d_event->Location);
+			if (d_event->ErrCode != UPNP_E_SUCCESS) {
+				LOG_DEBUG("Error in Discovery Callback -- %d", d_event->ErrCode);
 				break;
-			}
-
-			ithread_mutex_lock(&glMRFoundMutex);
-			p = &glMRFoundList;
-			while (*p) {
-				prev = *p;
-				p = &((*p)->Next);
-			}
-			(*p) = (struct sLocList*) malloc(sizeof (struct sLocList));
-			(*p)->Location = strdup(d_event->Location);
-			(*p)->Next = NULL;
-			if (prev) prev->Next = *p;
+			}
+
+			// known renderer, no need to download its description again
+			if (RefreshTO(d_event->DeviceId)) break;
+
+			// renderers answer once per device/service type
+			ithread_mutex_lock(&glMRFoundMutex);
+			for (p = &glMRFoundList; *p; p = &(*p)->Next) {
+				if (!strcmp((*p)->Location, d_event->Location) ||
+					(*d_event->DeviceId && !strcmp((*p)->UDN, d_event->DeviceId))) break;
+			}
+			if (!*p) {
+				*p = (struct sLocList*) malloc(sizeof (struct sLocList));
+				(*p)->Location = strdup(d_event->Location);
+				(*p)->UDN = strdup(d_event->DeviceId);
+				(*p)->Next = NULL;
+			}
 			ithread_mutex_unlock(&glMRFoundMutex);
 			break;
 		}
@@ -710,20 +835,46 @@ int CallbackEventHandler(Upnp_EventType EventType, void *Event, void *Cookie)
 
 			r = XMLGetFirstDocumentItem(Action->ActionResult, "Sink");
 			if (r) {
-				LOG_DEBUG("[%p]: ProtocolInfo %s (cookie %p)", p, r, Cookie);
+				LOG_DEBUG("[%p]: ProtocolInfo %s", p, r);
+				ithread_mutex_lock(&p->Mutex);
 				ParseProtocolInfo(p, r);
+				ithread_mutex_unlock(&p->Mutex);
+				UpdateCodecs(p);
 			}
 			NFREE(r);
 			break;
 		}
 		case UPNP_EVENT_RECEIVED:
+			HandleStateEvent((struct Upnp_Event*) Event, Cookie);
+			break;
+		case UPNP_EVENT_AUTORENEWAL_FAILED:
+		case UPNP_EVENT_SUBSCRIPTION_EXPIRED: {
+			struct Upnp_Event_Subscribe *d_Event = (struct Upnp_Event_Subscribe*) Event;
+			struct sMR *p = SID2Device(d_Event->Sid);
+			int i;
+
+			if (!p) break;
+
+			// back to fast polling until events are confirmed again
+			LOG_WARN("[%p]: subscription lost %s", p, d_Event->Sid);
+			ithread_mutex_lock(&p->Mutex);
+			p->Eventing = p->EventingURI = false;
+			ithread_mutex_unlock(&p->Mutex);
+
+			// an empty SID is what the subscribe job looks for
+			ithread_mutex_lock(&glMRAddMutex);
+			for (i = 0; i < NB_SRV; i++)
+				if (!strcmp(p->Service[i].SID, d_Event->Sid)) *p->Service[i].SID = '\0';
+			ithread_mutex_unlock(&glMRAddMutex);
+
+			ScheduleJob(p->Jobs + SUBSCRIBE_JOB, 0);
+			break;
+		}
 		case UPNP_DISCOVERY_ADVERTISEMENT_BYEBYE:
 		case UPNP_CONTROL_ACTION_REQUEST:
 		case UPNP_EVENT_SUBSCRIBE_COMPLETE:
 		case UPNP_EVENT_UNSUBSCRIBE_COMPLETE:
 		case UPNP_EVENT_RENEWAL_COMPLETE:
-		case UPNP_EVENT_AUTORENEWAL_FAILED:
-		case UPNP_EVENT_SUBSCRIPTION_EXPIRED:
 		case UPNP_EVENT_SUBSCRIPTION_REQUEST:
 		case UPNP_CONTROL_GET_VAR_REQUEST:
 		break;
@@ -734,118 +885,292 @@ int CallbackEventHandler(Upnp_EventType EventType, void *Event, void *Cookie)
 }
 
 /*----------------------------------------------------------------------------*/
-static bool RefreshTO(char *UDN)
+static void UpdateCodecs(struct sMR *Device)
 {
-	int i;
+	char Codecs[SQ_STR_LENGTH];
 
-	for (i = 0; i < MAX_RENDERERS; i++) {
-		if (glMRDevices[i].InUse && !strcmp(glMRDevices[i].UDN, UDN)) {
-			glMRDevices[i].uPNPTimeOut = false;
-			glMRDevices[i].uPNPMissingCount = glMRDevices[i].Config.uPNPRemoveCount;
-			glMRDevices[i].ErrorCount = 0;
-			return true;
-		}
-	}
-	return false;
+	if (!Device->SqueezeHandle || !Device->ProtocolCap[0]) return;
+
+	CodecsFromProtocolInfo(Device->ProtocolCap, Device->sq_config.codecs, Codecs);
+	if (!*Codecs) {
+		LOG_WARN("[%p]: no codec of <codecs> in ProtocolInfo, keeping %s", Device, Device->sq_config.codecs);
+		return;
+	}
+
+	LOG_INFO("[%p]: codecs from ProtocolInfo %s", Device, Codecs);
+	sq_set_codecs(Device->SqueezeHandle, Codecs);
 }
 
 /*----------------------------------------------------------------------------*/
-static void *UpdateMRThread(void *args)
+static bool RefreshTO(char *UDN)
 {
-	struct sLocList *p, *m;
-	struct sMR *Device = NULL;
-	int i, TimeStamp;
-
-	LOG_INFO("Begin uPnP devices update", NULL);
-	TimeStamp = gettime_ms();
-
-	// first add any newly found uPNP renderer
-	ithread_mutex_lock(&glMRFoundMutex);
-	m = p = glMRFoundList;
-	glMRFoundList = NULL;
-	ithread_mutex_unlock(&glMRFoundMutex);
+	struct sMR *Device = UDN2Device(UDN);
+
+	if (!Device || !Device->InUse) return false;
+
+	Device->uPNPTimeOut = false;
+	Device->uPNPMissingCount = Device->Config.uPNPRemoveCount;
+	// renderer announces itself, no need to wait for next probe
+	if (Device->Breaker == BREAKER_OPEN) ScheduleJob(Device->Jobs + PROBE_JOB, 0);
+	return true;
+}
 
-	if (!glMainRunning) {
-		LOG_INFO("Aborting ...", NULL);
-		while (p) {
-			m = p->Next;
-			free(p->Location); free(p);
-			p = m;
-		}
+/*----------------------------------------------------------------------------*/
+/* glMRAddMutex must be locked                                                */
+static struct sMR *CreateMRDevice(char *UDN, IXML_Document *DescDoc, char *Location, u8_t *CachedMac)
+{
+	struct sMR *Device;
+	int i;
+
+	// new device so search a free spot.
+	for (i = 0; i < MAX_RENDERERS && glMRDevices[i].InUse; i++);
+
+	// no more room !
+	if (i == MAX_RENDERERS) {
+		LOG_ERROR("Too many uPNP devices", NULL);
 		return NULL;
-	}
-
-	while (p) {
-		IXML_Document *DescDoc = NULL;
-		char *UDN = NULL, *Manufacturer = NULL;
-		int rc;
-		void *n = p->Next;
-
-		rc = UpnpDownloadXmlDoc(p->Location, &DescDoc);
-		if (rc != UPNP_E_SUCCESS) {
-			LOG_DEBUG("Error obtaining description %s -- error = %d\n", p->Location, rc);
-			if (DescDoc) ixmlDocument_free(DescDoc);
-			p = n;
-			continue;
-		}
-
-		Manufacturer = XMLGetFirstDocumentItem(DescDoc, "manufacturer");
-		UDN = XMLGetFirstDocumentItem(DescDoc, "UDN");
-		if (!strstr(Manufacturer, cLogitech) && !RefreshTO(UDN)) {
-			// new device so search a free spot.
-			for (i = 0; i < MAX_RENDERERS && glMRDevices[i].InUse; i++)
-
-			// no more room !
-			if (i == MAX_RENDERERS) {
-				LOG_ERROR("Too many uPNP devices", NULL);
-				NFREE(UDN); NFREE(Manufacturer);
-				break;
-			}
+	}
 
-			Device = &glMRDevices[i];
-			if (AddMRDevice(Device, UDN, DescDoc, p->Location) && !glSaveConfigFile) {
-				// create a new slimdevice
-				Device->SqueezeHandle = sq_reserve_device(Device, &sq_callback);
-				if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle,
-					*(Device->Config.Name) ? Device->Config.Name : Device->FriendlyName,
-					&Device->sq_config)) {
-					sq_release_device(Device->SqueezeHandle);
-					Device->SqueezeHandle = 0;
-					LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->FriendlyName);
-					DelMRDevice(Device);
-				}
-			}
-		}
+	Device = &glMRDevices[i];
+	if (AddMRDevice(Device, UDN, DescDoc, Location, CachedMac) && !glSaveConfigFile) {
+		// create a new slimdevice
+		Device->SqueezeHandle = sq_reserve_device(Device, &sq_callback);
+		if (!Device->SqueezeHandle || !sq_run_device(Device->SqueezeHandle,
+			*(Device->Config.Name) ? Device->Config.Name : Device->FriendlyName,
+			&Device->sq_config)) {
+			sq_release_device(Device->SqueezeHandle);
+			Device->SqueezeHandle = 0;
+			LOG_ERROR("[%p]: cannot create squeezelite instance (%s)", Device, Device->FriendlyName);
+			DelMRDevice(Device);
+		}
+		// ProtocolInfo might have been received before
+		else UpdateCodecs(Device);
+	}
+
+	return Device->InUse ? Device : NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *DescWorker(void *args)
+{
+	struct sLocList **Cursor = (struct sLocList**) args, *p;
+
+	while (glMainRunning) {
+		IXML_Document *DescDoc = NULL;
+		char *UDN = NULL, *Manufacturer = NULL;
+		struct sMR *Device = NULL;
+		int rc;
+
+		ithread_mutex_lock(&glMRFoundMutex);
+		if ((p = *Cursor) != NULL) *Cursor = p->Next;
+		ithread_mutex_unlock(&glMRFoundMutex);
+
+		if (!p) break;
+
+		rc = UpnpDownloadXmlDoc(p->Location, &DescDoc);
+		if (rc != UPNP_E_SUCCESS) {
+			LOG_DEBUG("Error obtaining description %s -- error = %d\n", p->Location, rc);
+			if (DescDoc) ixmlDocument_free(DescDoc);
+			continue;
+		}
+
+		Manufacturer = XMLGetFirstDocumentItem(DescDoc, "manufacturer");
+		UDN = XMLGetFirstDocumentItem(DescDoc, "UDN");
+
+		// different locations might still be the same renderer
+		ithread_mutex_lock(&glMRAddMutex);
+		if (!strstr(Manufacturer, cLogitech) && !RefreshTO(UDN)) {
+			Device = CreateMRDevice(UDN, DescDoc, p->Location, NULL);
+		}
+		ithread_mutex_unlock(&glMRAddMutex);
+
+		// slot is reserved, other renderers can be added while subscribing
+		if (Device) SubscribeMRDevice(Device);
 
-		if (DescDoc) ixmlDocument_free(DescDoc);
-		NFREE(UDN);	NFREE(Manufacturer);
-		p = n;
+		if (DescDoc) ixmlDocument_free(DescDoc);
+		NFREE(UDN);	NFREE(Manufacturer);
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void FetchDescriptions(struct sLocList *List)
+{
+	struct sLocList *p, *Cursor = List;
+	pthread_t Workers[DESC_WORKERS];
+	pthread_attr_t attr;
+	int i, n;
+
+	// descriptions are downloaded in parallel by a bounded set of workers
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 32*1024);
+	for (n = 0, p = List; glMainRunning && p && n < DESC_WORKERS; p = p->Next) {
+		if (!pthread_create(Workers + n, &attr, &DescWorker, &Cursor)) n++;
 	}
+	pthread_attr_destroy(&attr);
+	for (i = 0; i < n; i++) pthread_join(Workers[i], NULL);
 
-	// free the list of discovered location URL's
-	p = m;
-	while (p) {
-		m = p->Next;
-		free(p->Location); free(p);
-		p = m;
+	// free the list of location URL's
+	while (List) {
+		p = List->Next;
+		free(List->Location); free(List->UDN); free(List);
+		List = p;
 	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void *UpdateMRThread(void *args)
+{
+	struct sLocList *List;
+	struct sMR *Device = NULL;
+	int i, TimeStamp;
+
+	LOG_INFO("Begin uPnP devices update", NULL);
+	TimeStamp = gettime_ms();
 
+	// first add any newly found uPNP renderer
+	ithread_mutex_lock(&glMRFoundMutex);
+	List = glMRFoundList;
+	glMRFoundList = NULL;
+	ithread_mutex_unlock(&glMRFoundMutex);
+
+	FetchDescriptions(List);
+
+	if (!glMainRunning) {
+		LOG_INFO("Aborting ...", NULL);
+		return NULL;
+	}
+
 	// then walk through the list of devices to remove missing ones
+	ithread_mutex_lock(&glMRAddMutex);
 	for (i = 0; i < MAX_RENDERERS; i++) {
 		Device = &glMRDevices[i];
 		if (!Device->InUse || !Device->uPNPTimeOut ||
 			!Device->uPNPMissingCount || --Device->uPNPMissingCount) continue;
 
 		LOG_INFO("[%p]: removing renderer (%s)", Device, Device->FriendlyName);
-		if (Device->SqueezeHandle) sq_delete_device(Device->SqueezeHandle);
-		DelMRDevice(Device);
-	}
-
-	glDiscovery = true;
-	LOG_INFO("End uPnP devices update %d", gettime_ms() - TimeStamp);
-	return NULL;
+		if (Device->SqueezeHandle) sq_delete_device(Device->SqueezeHandle);
+		DelMRDevice(Device);
+	}
+	if (!glSaveConfigFile) SaveMRCache(glCacheName);
+	ithread_mutex_unlock(&glMRAddMutex);
+
+	glDiscovery = true;
+	LOG_INFO("End uPnP devices update %d", gettime_ms() - TimeStamp);
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *ValidateThread(void *args)
+{
+	struct sLocList *List = (struct sLocList*) args, *p;
+	struct sMR **Confirmed;
+	char **UDN;
+	int i, n, k = 0;
+
+	// FetchDescriptions frees the list, so keep the UDN's
+	for (n = 0, p = List; p; p = p->Next) n++;
+	UDN = malloc(n * sizeof(char*));
+	Confirmed = malloc(n * sizeof(struct sMR*));
+	for (i = 0, p = List; p; p = p->Next) UDN[i++] = strdup(p->UDN);
+
+	// a renderer whose description is fetched is refreshed by DescWorker
+	FetchDescriptions(List);
+
+	// confirmed renderers can now subscribe to events
+	ithread_mutex_lock(&glMRAddMutex);
+	for (i = 0; i < n; i++) {
+		struct sMR *Device = UDN2Device(UDN[i]);
+
+		free(UDN[i]);
+		if (!glMainRunning || !Device || !Device->InUse || Device->uPNPTimeOut) continue;
+
+		LOG_INFO("[%p]: cached renderer confirmed (%s)", Device, Device->FriendlyName);
+		Confirmed[k++] = Device;
+	}
+	ithread_mutex_unlock(&glMRAddMutex);
+
+	for (i = 0; i < k && glMainRunning; i++) SubscribeMRDevice(Confirmed[i]);
+
+	free(Confirmed);
+	free(UDN);
+	return NULL;
 }
 
+/*----------------------------------------------------------------------------*/
+/*
+Renderers known at last run are created right away from the cache, without
+waiting for the search to end. They are flagged as not seen so they go away
+like any missing renderer unless SSDP or a direct description fetch (done in
+background) confirms them
+*/
+static void RestoreMRCache(char *name)
+{
+	IXML_Document *doc = ixmlLoadDocument(name);
+	IXML_NodeList *l1_node_list;
+	struct sLocList *List = NULL;
+	unsigned i;
+
+	if (!doc) return;
+
+	l1_node_list = ixmlDocument_getElementsByTagName(doc, "renderer");
+
+	ithread_mutex_lock(&glMRAddMutex);
+	for (i = 0; l1_node_list && i < ixmlNodeList_length(l1_node_list); i++) {
+		IXML_Element *elm = (IXML_Element*) ixmlNodeList_item(l1_node_list, i);
+		char *UDN = XMLGetFirstElementItem(elm, "udn");
+		char *Location = XMLGetFirstElementItem(elm, "location");
+		char *Description = XMLGetFirstElementItem(elm, "description");
+		char *Mac = XMLGetFirstElementItem(elm, "mac");
+		char *Info = XMLGetFirstElementItem(elm, "protocol_info");
+		IXML_Document *DescDoc = Description ? ixmlParseBuffer(Description) : NULL;
+		struct sMR *Device = NULL;
+		u8_t mac[6] = { 0 };
+
+		if (Mac) sscanf(Mac, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+						&mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+
+		if (UDN && Location && DescDoc && !UDN2Device(UDN))
+			Device = CreateMRDevice(UDN, DescDoc, Location, mac);
+
+		if (Device) {
+			struct sLocList *p = malloc(sizeof(struct sLocList));
+
+			LOG_INFO("[%p]: restored from cache (%s)", Device, Device->FriendlyName);
+			Device->uPNPTimeOut = true;
+			if (Info) {
+				ithread_mutex_lock(&Device->Mutex);
+				ParseProtocolInfo(Device, Info);
+				ithread_mutex_unlock(&Device->Mutex);
+				UpdateCodecs(Device);
+			}
+
+			p->Location = strdup(Location);
+			p->UDN = strdup(UDN);
+			p->Next = List;
+			List = p;
+		}
+
+		if (DescDoc) ixmlDocument_free(DescDoc);
+		NFREE(UDN); NFREE(Location); NFREE(Description); NFREE(Mac); NFREE(Info);
+	}
+	ithread_mutex_unlock(&glMRAddMutex);
+
+	if (l1_node_list) ixmlNodeList_free(l1_node_list);
+	ixmlDocument_free(doc);
+
+	// joined in Stop(), as it uses renderers that are flushed there
+	if (List) {
+		pthread_attr_t attr;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 32*1024);
+		glValidating = !pthread_create(&glValidateThread, &attr, &ValidateThread, List);
+		pthread_attr_destroy(&attr);
+	}
+}
+
 /*----------------------------------------------------------------------------*/
 static void *MainThread(void *args)
 {
@@ -878,48 +1203,143 @@ static void *MainThread(void *args)
 }
 
 /*----------------------------------------------------------------------------*/
-#define TRACK_POLL (1000)
-#define STATE_POLL (500)
-#define MAX_ACTION_ERRORS (5)
-static void *MRThread(void *args)
+static u32_t StateJob(struct sMR *p)
 {
-	int elapsed;
-	unsigned last;
-	struct sMR *p = (struct sMR*) args;
+	u32_t Next;
 
-	last = gettime_ms();
-	for (; p->Running;  usleep(500000)) {
-		elapsed = gettime_ms() - last;
-		ithread_mutex_lock(&p->Mutex);
+	ithread_mutex_lock(&p->Mutex);
 
-		if (!p->on || (p->sqState == SQ_STOP && p->State == STOPPED) ||
-			 p->ErrorCount > MAX_ACTION_ERRORS) {
-			ithread_mutex_unlock(&p->Mutex);
-			continue;
-		}
+	// nothing at all until LMS switches renderer on again
+	if (!p->on || p->Breaker == BREAKER_OPEN) Next = 0;
+	else if (p->sqState == SQ_STOP && p->State == STOPPED) Next = IDLE_POLL;
+	else {
+		// do polling as event is broken in many uPNP devices, slow health check otherwise
+		AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetTransportInfo", ++p->ActionId);
+		if (p->EventingURI && p->State == PLAYING)
+			AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetMediaInfo", ++p->ActionId);
 
-		// get track position & CurrentURI
-		p->TrackPoll += elapsed;
-		if (p->TrackPoll > TRACK_POLL) {
-			p->TrackPoll = 0;
-			if (p->State != STOPPED && p->State != PAUSED) {
-				AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetPositionInfo", p->seqN++);
-				AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetMediaInfo", p->seqN++);
-			}
-		}
+		if (p->State == TRANSITIONING) Next = TRANSITION_POLL;
+		else Next = p->Eventing ? STATE_POLL_EVENT : STATE_POLL;
+	}
 
-		// do polling as event is broken in many uPNP devices
-		p->StatePoll += elapsed;
-		if (p->StatePoll > STATE_POLL) {
-			p->StatePoll = 0;
-			AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetTransportInfo", p->seqN++);
-		}
+	ithread_mutex_unlock(&p->Mutex);
 
-		ithread_mutex_unlock(&p->Mutex);
-		last = gettime_ms();
+	return Next;
+}
+
+/*----------------------------------------------------------------------------*/
+static u32_t PositionJob(struct sMR *p)
+{
+	u32_t Next = IDLE_POLL;
+
+	ithread_mutex_lock(&p->Mutex);
+
+	if (!p->on || p->Breaker == BREAKER_OPEN) Next = 0;
+	else if (!(p->sqState == SQ_STOP && p->State == STOPPED) &&
+			 p->State != STOPPED && p->State != PAUSED) {
+		// position is never evented
+		AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetPositionInfo", ++p->ActionId);
+		if (!p->EventingURI) AVTCallAction(p->Service[AVT_SRV_IDX].ControlURL, "GetMediaInfo", ++p->ActionId);
+		Next = TRACK_POLL;
 	}
 
-	return NULL;
+	ithread_mutex_unlock(&p->Mutex);
+
+	return Next;
+}
+
+/*----------------------------------------------------------------------------*/
+static void ScheduleDevice(struct sMR *Device, u32_t Delay)
+{
+	// spread renderers over the poll period so that they do not all fire at once
+	u32_t Stagger = ((Device - glMRDevices) * 97) % STATE_POLL;
+
+	ScheduleJob(Device->Jobs + STATE_JOB, Delay + Stagger);
+	ScheduleJob(Device->Jobs + POSITION_JOB, Delay + Stagger + TRACK_POLL / 2);
+	if (Device->Breaker == BREAKER_OPEN) ScheduleJob(Device->Jobs + PROBE_JOB, Delay);
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+Circuit breaker: after too many failed actions, polling stops (open) and the
+renderer is only probed with exponential back-off. Once it answers, polling
+resumes on trial (half-open) and the first successful action closes the
+breaker, while a failed one re-opens it
+*/
+static void OpenBreaker(struct sMR *Device)
+{
+	ithread_mutex_lock(&Device->Mutex);
+
+	if (Device->Breaker != BREAKER_OPEN) {
+		// back-off only grows when a trial fails
+		if (Device->Breaker == BREAKER_CLOSED) Device->ProbeDelay = PROBE_MIN;
+		else Device->ProbeDelay = Device->ProbeDelay * 2 < PROBE_MAX ? Device->ProbeDelay * 2 : PROBE_MAX;
+		Device->Breaker = BREAKER_OPEN;
+		LOG_WARN("[%p]: %s not responding, probing every %u ms", Device, Device->FriendlyName, Device->ProbeDelay);
+		ScheduleJob(Device->Jobs + PROBE_JOB, Device->ProbeDelay);
+	}
+
+	ithread_mutex_unlock(&Device->Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static void CloseBreaker(struct sMR *Device)
+{
+	ithread_mutex_lock(&Device->Mutex);
+
+	Device->Breaker = BREAKER_CLOSED;
+	Device->ErrorCount = 0;
+	LOG_INFO("[%p]: %s is back", Device, Device->FriendlyName);
+
+	// renderer might have stopped while away, resume what LMS is doing
+	if (Device->on && Device->sqState == SQ_PLAY && (Device->State == STOPPED || Device->State == PAUSED))
+		AVTPlay(Device->Service[AVT_SRV_IDX].ControlURL, ++Device->ActionId);
+
+	ithread_mutex_unlock(&Device->Mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+static int ProbeHandler(Upnp_EventType EventType, void *Event, void *Cookie)
+{
+	struct Upnp_Action_Complete *Probe = (struct Upnp_Action_Complete*) Event;
+	struct sMR *Device = IsDevice(Cookie);
+
+	if (!Device || strcmp(Device->DescDocURL, Probe->CtrlUrl)) return 0;
+
+	ithread_mutex_lock(&Device->Mutex);
+
+	if (Device->Breaker == BREAKER_OPEN) {
+		if (Probe->ErrCode == UPNP_E_SUCCESS) {
+			LOG_INFO("[%p]: %s answered probe, trying again", Device, Device->FriendlyName);
+			Device->Breaker = BREAKER_HALF;
+			Device->ErrorCount = 0;
+			ScheduleDevice(Device, 0);
+		} else {
+			Device->ProbeDelay = Device->ProbeDelay * 2 < PROBE_MAX ? Device->ProbeDelay * 2 : PROBE_MAX;
+			LOG_DEBUG("[%p]: probe failed %d, next in %u ms", Device, Probe->ErrCode, Device->ProbeDelay);
+			ScheduleJob(Device->Jobs + PROBE_JOB, Device->ProbeDelay);
+		}
+	}
+
+	ithread_mutex_unlock(&Device->Mutex);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+static u32_t ProbeJob(struct sMR *p)
+{
+	u32_t Next = 0;
+
+	ithread_mutex_lock(&p->Mutex);
+
+	// re-armed by probe answer, unless it cannot even be sent
+	if (p->on && p->Breaker == BREAKER_OPEN &&
+		SOAPProbe(p->DescDocURL, ProbeHandler, p) != UPNP_E_SUCCESS) Next = p->ProbeDelay;
+
+	ithread_mutex_unlock(&p->Mutex);
+
+	return Next;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -935,6 +1355,7 @@ int uPNPInitialize(char *IPaddress, unsigned int *Port)
 	}
 
 	ithread_mutex_init(&glMRFoundMutex, 0);
+	ithread_mutex_init(&glMRAddMutex, 0);
 	memset(&glMRDevices, 0, sizeof(glMRDevices));
 
 	UpnpSetLogLevel(UPNP_ALL);
@@ -1069,10 +1490,86 @@ void SetVolumeCurve(struct sMR *Device)
 
 	Device->VolumeCurve[i].a = 0x7fffffff;
 	Device->VolumeCurve[i].b = 0x7f;
+
+	memset(Device->VolumeLUT, 0, sizeof(Device->VolumeLUT));
+}
+
+/*----------------------------------------------------------------------------*/
+static u8_t Gain2Volume(struct sMR *Device, u32_t Gain)
+{
+	/*
+	Gain is 16.16 so a full table is not an option, but LMS only sends one
+	gain per volume step (101 values), so interpolation is done once per gain
+	and kept in a small open-addressed table (key is gain + 1, 0 is free)
+	*/
+	u32_t h = ((Gain * 2654435761U) >> 16) % VOLUME_LUT, n;
+	s32_t a2, b2, a1 = 0, b1 = 0;
+	u8_t Volume;
+	int i;
+
+	for (n = 0; n < VOLUME_LUT; n++, h = (h + 1) % VOLUME_LUT) {
+		if (Device->VolumeLUT[h].Key == Gain + 1) return Device->VolumeLUT[h].Volume;
+		if (!Device->VolumeLUT[h].Key) break;
+	}
+
+	for (i = 0; i < 32 && Gain > Device->VolumeCurve[i].a; i++);
+
+	a1 = (i) ? Device->VolumeCurve[i-1].a : 0;
+	b1 = (i) ? Device->VolumeCurve[i-1].b : 0;
+	a2 = Device->VolumeCurve[i].a;
+	b2 = Device->VolumeCurve[i].b;
+	// volume and a are 16 bits, b are 8, so 7 bits precision can be added
+	if (a2) Volume = (((s32_t)Gain*(b1-b2)*128)/(a1-a2) + b1*128 - (a1*(b1-b2)*128)/(a1-a2)) / 128;
+	else Volume = 0;
+
+	if (n < VOLUME_LUT) {
+		Device->VolumeLUT[h].Key = Gain + 1;
+		Device->VolumeLUT[h].Volume = Volume;
+	}
+
+	return Volume;
+}
+
+/*----------------------------------------------------------------------------*/
+/* device mutex must be locked                                                */
+static void SendVolume(struct sMR *Device)
+{
+	u32_t now = gettime_ms();
+
+	// latest value is sent at most every VOLUME_INTERVAL, with a trailing one
+	if (now - Device->VolumeSent >= VOLUME_INTERVAL) {
+		SetVolume(Device->Service[REND_SRV_IDX].ControlURL, Device->Volume, ++Device->ActionId);
+		Device->VolumeSent = now;
+		Device->VolumePending = false;
+	} else if (!Device->VolumePending) {
+		Device->VolumePending = true;
+		ScheduleJob(Device->Jobs + VOLUME_JOB, VOLUME_INTERVAL - (now - Device->VolumeSent));
+	}
 }
 
 /*----------------------------------------------------------------------------*/
-static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, const char *location)
+static u32_t VolumeJob(struct sMR *p)
+{
+	ithread_mutex_lock(&p->Mutex);
+
+	if (p->VolumePending) {
+		SetVolume(p->Service[REND_SRV_IDX].ControlURL, p->Volume, ++p->ActionId);
+		p->VolumeSent = gettime_ms();
+		p->VolumePending = false;
+	}
+
+	ithread_mutex_unlock(&p->Mutex);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/*
+When restored from cache (CachedMac is set) the mac is known. Subscription is
+left to the caller, once glMRAddMutex is released (see SubscribeMRDevice) and,
+for a cached renderer that might be gone, once it has been confirmed
+*/
+static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, const char *location, u8_t *CachedMac)
 {
 	char *deviceType = NULL;
 	char *friendlyName = NULL;
@@ -1084,7 +1581,6 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	char *manufacturer = NULL;
 	int i;
 	u8_t mac_size = 6;
-	pthread_attr_t attr;
 
 	// read parameters from default then config file
 	memset(Device, 0, sizeof(struct sMR));
@@ -1119,15 +1615,21 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	Device->on = false;
 	Device->SqueezeHandle = 0;
 	Device->ErrorCount = 0;
-	Device->Running = true;
+	Device->Breaker = BREAKER_CLOSED;
+	Device->ActionId = 0;
+	Device->VolumePending = false;
+	Device->VolumeSent = gettime_ms() - VOLUME_INTERVAL;
 	Device->InUse = true;
 	strcpy(Device->UDN, UDN);
 	strcpy(Device->DescDocURL, location);
 	strcpy(Device->FriendlyName, friendlyName);
 	strcpy(Device->Manufacturer, manufacturer);
+	Device->Description = ixmlPrintDocument(DescDoc);
 	SetVolumeCurve(Device);
 
 	ExtractIP(location, &Device->ip);
+	if (CachedMac && !memcmp(Device->sq_config.mac, "\0\0\0\0\0\0", mac_size))
+		memcpy(Device->sq_config.mac, CachedMac, mac_size);
 	if (!memcmp(Device->sq_config.mac, "\0\0\0\0\0\0", mac_size) &&
 		SendARP(*((in_addr_t*) &Device->ip), INADDR_ANY, Device->sq_config.mac, &mac_size)) {
 		LOG_ERROR("[%p]: cannot get mac %s", Device, Device->FriendlyName);
@@ -1146,15 +1648,18 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 			strncpy(s->ControlURL, ControlURL, RESOURCE_LENGTH-1);
 			strncpy(s->EventURL, EventURL, RESOURCE_LENGTH - 1);
 			strcpy(s->Type, cSearchedSRV[i].name);
-			s->TO = 60;
+			s->TO = SUBSCRIBE_TIMEOUT;
 		}
 		NFREE(ServiceId);
 		NFREE(EventURL);
 		NFREE(ControlURL);
-	}
-
+	}
+
+	// answers to actions (incl. GetProtocolInfo below) are matched by ControlURL
+	IndexMRDevice(Device, true);
+
 	// send a request for "sink" (will be returned in a callback)
-	GetProtocolInfo(Device->Service[CNX_MGR_IDX].ControlURL, Device->seqN++);
+	GetProtocolInfo(Device->Service[CNX_MGR_IDX].ControlURL, ++Device->ActionId);
 
 	NFREE(deviceType);
 	NFREE(friendlyName);
@@ -1162,28 +1667,49 @@ static bool AddMRDevice(struct sMR *Device, char *UDN, IXML_Document *DescDoc, c
 	NFREE(presURL);
 	NFREE(manufacturer);
 
-	pthread_attr_init(&attr);
-	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 32*1024);
-	pthread_create(&Device->Thread, &attr, &MRThread, Device);
-	pthread_attr_destroy(&attr);
+	Device->Jobs[STATE_JOB].Run = StateJob;
+	Device->Jobs[POSITION_JOB].Run = PositionJob;
+	Device->Jobs[PROBE_JOB].Run = ProbeJob;
+	Device->Jobs[VOLUME_JOB].Run = VolumeJob;
+	Device->Jobs[SUBSCRIBE_JOB].Run = SubscribeJob;
+	for (i = 0; i < NB_JOBS; i++) Device->Jobs[i].Device = Device;
+	ScheduleDevice(Device, 0);
 
 	return true;
 }
 
 /*----------------------------------------------------------------------------*/
 static bool Start(void)
-{
-	if (!uPNPInitialize(glIPaddress, &glPort)) return false;
+{
+	ArtworkInit();
+	InitScheduler();
+	SOAPInit(glLog.upnp);
+	if (!uPNPInitialize(glIPaddress, &glPort)) return false;
+	if (!glSaveConfigFile) RestoreMRCache(glCacheName);
 	uPNPSearchMediaRenderer();
 	return true;
 }
 
 static bool Stop(void)
 {
+	if (glValidating) {
+		LOG_DEBUG("wait for cache validation ...", NULL);
+		pthread_join(glValidateThread, NULL);
+		glValidating = false;
+	}
+
 	LOG_DEBUG("flush renderers ...", NULL);
+	if (!glSaveConfigFile) {
+		ithread_mutex_lock(&glMRAddMutex);
+		SaveMRCache(glCacheName);
+		ithread_mutex_unlock(&glMRAddMutex);
+	}
 	FlushMRDevices();
+	StopScheduler();
+	SOAPClose();
 	LOG_DEBUG("terminate libupnp ...", NULL);
 	uPNPTerminate();
+	ArtworkClose();
 	return true;
 }
 
@@ -1331,8 +1857,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	// load config from xml file
+	// load config from xml file, known renderers are cached next to it
 	glConfigID = (void*) LoadConfig(glConfigName, &glMRConfig, &glDeviceParam);
+	sprintf(glCacheName, "%s.cache", glConfigName);
 
 	// potentially overwrite with some cmdline parameters
 	if (!ParseArgs(argc, argv)) exit(1);
@@ -1446,9 +1973,31 @@ int main(int argc, char *argv[])
 		}
 
 		 if (!strcmp(resp, "save"))	{
-			char name[128];
-			i = scanf("%s", name);
-			SaveConfig(name);
+			char name[128];
+			i = scanf("%s", name);
+			SaveConfig(name);
+		}
+
+		if (!strcmp(resp, "stats"))	{
+			struct sSOAPStats soap;
+			u32_t hits, misses, entries;
+			sq_metadata_stats(&hits, &misses, &entries);
+			printf("metadata cache: %u hits, %u misses, %u entries\n", hits, misses, entries);
+			SOAPStats(&soap);
+			printf("control connections: %u opened, %u reused, %u idle\n", soap.Opened, soap.Reused, soap.Idle);
+			printf("control requests: %u queued (peak %u), polls %u collapsed, %u dropped\n",
+					soap.Queued, soap.Peak, soap.Collapsed, soap.Dropped);
+			for (i = 0; i < SOAP_ACTIONS && soap.Latency[i].Count; i++) {
+				u32_t Bounds[] = SOAP_BOUNDS;
+				int j;
+
+				printf("  %-22s %6u max %5ums |", soap.Latency[i].Action, soap.Latency[i].Count, soap.Latency[i].Max);
+				for (j = 0; j < SOAP_BUCKETS; j++) {
+					if (j < SOAP_BUCKETS - 1) printf(" <%u:%u", Bounds[j], soap.Latency[i].Buckets[j]);
+					else printf(" more:%u", soap.Latency[i].Buckets[j]);
+				}
+				printf("\n");
+			}
 		}
 	}
 
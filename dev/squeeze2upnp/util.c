@@ -89,6 +89,51 @@ char *XMLGetFirstDocumentItem(IXML_Document *doc, const char *item)
 	return ret;
 }
 
+/*----------------------------------------------------------------------------*/
+int XMLGetItems(IXML_Document *doc, const char *Items[], const char *Values[], int n)
+{
+	IXML_Node *node = ixmlNode_getFirstChild((IXML_Node*) doc);
+	int i, found = 0;
+
+	for (i = 0; i < n; i++) Values[i] = NULL;
+
+	/*
+	One depth-first walk for all items, first occurrence wins. Values are not
+	copied so they are only valid as long as doc is
+	*/
+	while (node && found < n) {
+		IXML_Node *next;
+
+		if (ixmlNode_getNodeType(node) == eELEMENT_NODE) {
+			const char *name = ixmlNode_getNodeName(node);
+
+			for (i = 0; i < n; i++) {
+				IXML_Node *text;
+
+				if (Values[i] || strcmp(name, Items[i])) continue;
+				text = ixmlNode_getFirstChild(node);
+				Values[i] = text ? ixmlNode_getNodeValue(text) : NULL;
+				if (!Values[i]) Values[i] = "";
+				found++;
+				break;
+			}
+		}
+
+		// next in document order
+		next = ixmlNode_getFirstChild(node);
+		while (!next && node) {
+			next = ixmlNode_getNextSibling(node);
+			if (!next) {
+				node = ixmlNode_getParentNode(node);
+				if (node == (IXML_Node*) doc) node = NULL;
+			}
+		}
+		node = next;
+	}
+
+	return found;
+}
+
 /*----------------------------------------------------------------------------*/
 char *XMLGetFirstElementItem(IXML_Element *element, const char *item)
 {
@@ -260,16 +305,25 @@ char *XMLGetChangeItem(IXML_Document *doc, char *Item)
 	}
 
 	buf = strdup(ixmlNode_getNodeValue(textnode));
-	p = strstr(buf, Item);
+
+	// <Item val="..."/>, Item must not be the prefix of another tag (strtok is not re-entrant)
+	for (p = buf; (p = strstr(p, Item)) != NULL; p += strlen(Item)) {
+		if (p > buf && p[-1] == '<' && (p[strlen(Item)] == ' ' || p[strlen(Item)] == '/')) break;
+	}
+
+	// value must belong to that tag
 	if (p) {
-		p = strtok(p, "\"");
-		p = strtok(NULL, "\"");
-		strcpy(buf, p);
+		char *end = strchr(p, '>');
+		p = strstr(p, "val=\"");
+		if (end && p > end) p = NULL;
 	}
-	else {
-		free(buf);
-		buf = NULL;
+
+	if (p) {
+		char *q = strchr(p + 5, '"');
+		if (q) *q = '\0';
+		memmove(buf, p + 5, strlen(p + 5) + 1);
 	}
+	else NFREE(buf);
 
 	ixmlNodeList_free(changenodelist);
 
@@ -303,28 +357,18 @@ IXML_Node *XMLAddNode(IXML_Document *doc, IXML_Node *parent, char *name, char *f
 }
 
 /*----------------------------------------------------------------------------*/
-unsigned Time2Int(char *Time)
+unsigned Time2Int(const char *Time)
 {
-	char *p;
-	unsigned ret;
-
-	p = strrchr(Time, ':');
+	unsigned ret = 0;
+	const char *p = Time;
 
-	if (!p) return 0;
+	// H+:MM:SS[.F+], read left to right so that Time is not modified
+	if (!strchr(Time, ':')) return 0;
 
-	*p = '\0';
-	ret = atol(p + 1);
-
-	p = strrchr(Time, ':');
-	if (p) {
-		*p = '\0';
-		ret += atol(p + 1)*60;
-	}
-
-	p = strrchr(Time, ':');
-	if (p) {
-		*p = '\0';
-		ret += atol(p + 1)*3600;
+	while (p) {
+		ret = ret * 60 + atol(p);
+		p = strchr(p, ':');
+		if (p) p++;
 	}
 
 	return ret;
@@ -25,8 +25,251 @@
 #include "squeeze2upnp.h"
 #include "webserver.h"
 
-static log_level	loglevel = lWARN;
+/*
+Artwork is fetched once from LMS and served from our own virtual directory, so
+that players do not need to reach LMS and get a stable url per cover. Images
+are kept in RAM, least recently used one being evicted when full
+*/
+#define ARTWORK_PREFIX	"__art__"
+#define ARTWORK_COUNT	32
+#define ARTWORK_HANDLES	8
+#define ARTWORK_MAX		(512*1024)
+#define ARTWORK_AGE		(24*3600)
+#define ARTWORK_TIMEOUT	5
+
+static struct sArtwork {
+	u32_t	Id;
+	char	*URL;
+	char	*Data;
+	size_t	Size;
+	char	*ContentType;
+	time_t	Time;
+	u32_t	Last;
+} glArtwork[ARTWORK_COUNT];
+
+static struct sArtworkHandle {
+	bool	InUse;
+	char	*Data;
+	size_t	Size, Pos;
+} glArtworkHandles[ARTWORK_HANDLES];
+
+static ithread_mutex_t	glArtworkMutex;
+static u32_t			glArtworkId;
+static log_level		loglevel = lWARN;
+
+/*---------------------------------------------------------------------------*/
+void ArtworkInit(void)
+{
+	memset(glArtwork, 0, sizeof(glArtwork));
+	memset(glArtworkHandles, 0, sizeof(glArtworkHandles));
+	ithread_mutex_init(&glArtworkMutex, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+void ArtworkClose(void)
+{
+	int i;
 
+	ithread_mutex_lock(&glArtworkMutex);
+	for (i = 0; i < ARTWORK_COUNT; i++) {
+		NFREE(glArtwork[i].URL);
+		NFREE(glArtwork[i].Data);
+		NFREE(glArtwork[i].ContentType);
+		glArtwork[i].Id = 0;
+	}
+	ithread_mutex_unlock(&glArtworkMutex);
+}
+
+/*---------------------------------------------------------------------------*/
+char *ArtworkProxy(char *URL)
+{
+	struct sArtwork *p = NULL;
+	char *Proxy;
+	int i;
+
+	if (!URL || strncmp(URL, "http", 4)) return NULL;
+
+	ithread_mutex_lock(&glArtworkMutex);
+
+	// same cover, same url so that players can cache it as well
+	for (i = 0; i < ARTWORK_COUNT; i++) {
+		if (glArtwork[i].URL && !strcmp(glArtwork[i].URL, URL)) {
+			p = glArtwork + i;
+			break;
+		}
+		if (!p || !glArtwork[i].URL || (p->URL && (s32_t) (glArtwork[i].Last - p->Last) < 0)) p = glArtwork + i;
+	}
+
+	if (!p->URL || strcmp(p->URL, URL)) {
+		NFREE(p->URL);
+		NFREE(p->Data);
+		NFREE(p->ContentType);
+		p->URL = strdup(URL);
+		p->Size = 0;
+		if (!++glArtworkId) glArtworkId++;
+		p->Id = glArtworkId;
+	}
+
+	p->Last = gettime_ms();
+
+	Proxy = malloc(strlen(glIPaddress) + strlen(glBaseVDIR) + strlen(ARTWORK_PREFIX) + 32);
+	sprintf(Proxy, "http://%s:%d/%s/" ARTWORK_PREFIX "%u.jpg", glIPaddress, glPort, glBaseVDIR, p->Id);
+
+	ithread_mutex_unlock(&glArtworkMutex);
+
+	return Proxy;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct sArtwork *ArtworkFind(const char *FileName)
+{
+	char *p = strstr(FileName, ARTWORK_PREFIX);
+	u32_t Id;
+	int i;
+
+	if (!p || !(Id = atol(p + strlen(ARTWORK_PREFIX)))) return NULL;
+
+	for (i = 0; i < ARTWORK_COUNT; i++)
+		if (glArtwork[i].URL && glArtwork[i].Id == Id) return glArtwork + i;
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool ArtworkFetch(const char *FileName)
+{
+	struct sArtwork *p;
+	void *Handle = NULL;
+	char *URL, *ContentType, *Data = NULL;
+	int rc, Length, Status = 0;
+	size_t Size = 0, Read;
+	u32_t Id;
+
+	ithread_mutex_lock(&glArtworkMutex);
+	p = ArtworkFind(FileName);
+	if (!p || p->Data) {
+		ithread_mutex_unlock(&glArtworkMutex);
+		return p != NULL;
+	}
+	URL = strdup(p->URL);
+	Id = p->Id;
+	ithread_mutex_unlock(&glArtworkMutex);
+
+	// do not hold the lock while LMS is answering
+	rc = UpnpOpenHttpGet(URL, &Handle, &ContentType, &Length, &Status, ARTWORK_TIMEOUT);
+	if (rc == UPNP_E_SUCCESS && Status == 200 && Length <= ARTWORK_MAX) {
+		Data = malloc(ARTWORK_MAX);
+		do {
+			Read = ARTWORK_MAX - Size;
+			rc = UpnpReadHttpGet(Handle, Data + Size, &Read, ARTWORK_TIMEOUT);
+			Size += Read;
+		} while (rc == UPNP_E_SUCCESS && Read && Size < ARTWORK_MAX);
+		ContentType = strdup(ContentType ? ContentType : "image/jpeg");
+		if (rc != UPNP_E_SUCCESS || !Size || Size == ARTWORK_MAX) {
+			NFREE(Data);
+			NFREE(ContentType);
+		}
+	}
+	if (Handle) UpnpCloseHttpGet(Handle);
+
+	if (!Data) {
+		LOG_WARN("cannot get artwork %s (rc:%d status:%d)", URL, rc, Status);
+		free(URL);
+		return false;
+	}
+
+	LOG_INFO("artwork %s (%d bytes) %s", URL, (int) Size, ContentType);
+	free(URL);
+
+	ithread_mutex_lock(&glArtworkMutex);
+	p = ArtworkFind(FileName);
+	// entry might have been evicted or fetched by someone else meanwhile
+	if (p && p->Id == Id && !p->Data) {
+		p->Data = realloc(Data, Size);
+		p->Size = Size;
+		p->ContentType = ContentType;
+		p->Time = time(NULL);
+	} else {
+		free(Data);
+		free(ContentType);
+	}
+	ithread_mutex_unlock(&glArtworkMutex);
+
+	return p != NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static int ArtworkGetInfo(const char *FileName, struct File_Info *Info)
+{
+	struct sArtwork *p;
+
+	if (!ArtworkFetch(FileName)) return -1;
+
+	ithread_mutex_lock(&glArtworkMutex);
+	p = ArtworkFind(FileName);
+	if (p && p->Data) {
+		Info->is_directory = false;
+		Info->is_readable = true;
+		Info->last_modified = p->Time;
+		Info->file_length = p->Size;
+		Info->content_type = ixmlCloneDOMString(p->ContentType);
+		p->Last = gettime_ms();
+	}
+	ithread_mutex_unlock(&glArtworkMutex);
+
+	if (!p || !p->Data) return -1;
+
+	// only way to add a response header, need at least one unknown request header
+	if (Info->extra_headers && Info->extra_headers->name && !Info->extra_headers->resp) {
+		char Header[64];
+		sprintf(Header, "Cache-Control: max-age=%d", ARTWORK_AGE);
+		Info->extra_headers->resp = ixmlCloneDOMString(Header);
+	}
+
+	LOG_INFO("artwork GetInfo %s %Ld %s", FileName, (s64_t) Info->file_length, Info->content_type);
+
+	return UPNP_E_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *ArtworkOpen(const char *FileName)
+{
+	struct sArtworkHandle *h = NULL;
+	struct sArtwork *p;
+	int i;
+
+	ithread_mutex_lock(&glArtworkMutex);
+
+	p = ArtworkFind(FileName);
+	for (i = 0; p && p->Data && i < ARTWORK_HANDLES; i++) {
+		if (glArtworkHandles[i].InUse) continue;
+		// own copy as the cache entry might be evicted while being sent
+		h = glArtworkHandles + i;
+		h->Data = malloc(p->Size);
+		memcpy(h->Data, p->Data, p->Size);
+		h->Size = p->Size;
+		h->Pos = 0;
+		h->InUse = true;
+		break;
+	}
+
+	ithread_mutex_unlock(&glArtworkMutex);
+
+	if (!h) LOG_ERROR("cannot open artwork %s", FileName);
+
+	return h;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct sArtworkHandle *ArtworkHandle(void *FileHandle)
+{
+	struct sArtworkHandle *h = (struct sArtworkHandle*) FileHandle;
+
+	if (h >= glArtworkHandles && h < glArtworkHandles + ARTWORK_HANDLES) return h;
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
 int WebGetInfo(const char *FileName, struct File_Info *Info)
 {
 #ifdef TEST_IDX_BUF
@@ -58,6 +301,8 @@ int WebGetInfo(const char *FileName, struct File_Info *Info)
 #endif
 	}
 
+	if (strstr(FileName, ARTWORK_PREFIX)) return ArtworkGetInfo(FileName, Info);
+
 	Ref = sq_get_info(FileName, &FileSize, &Info->content_type);
 	Info->is_directory = false;
 	Info->is_readable = true;
@@ -97,7 +342,8 @@ UpnpWebFileHandle WebOpen(const char *FileName, enum UpnpOpenFileMode Mode)
 
 	else
 #endif
-	{
+	if (strstr(FileName, ARTWORK_PREFIX)) p = ArtworkOpen(FileName);
+	else {
 		p = sq_open(FileName);
 		if (!p) {
 			LOG_ERROR("No context for %s", FileName);
@@ -115,10 +361,19 @@ int WebWrite(UpnpWebFileHandle FileHandle, char *buf, size_t buflen)
 
 int WebRead(UpnpWebFileHandle FileHandle, char *buf, size_t buflen)
 {
+	struct sArtworkHandle *h = ArtworkHandle(FileHandle);
 	int read;
 
 	if (!FileHandle) return 0;
 
+	if (h) {
+		read = h->Size - h->Pos;
+		if (read > (int) buflen) read = buflen;
+		memcpy(buf, h->Data + h->Pos, read);
+		h->Pos += read;
+		return read;
+	}
+
 	read = sq_read(FileHandle, buf, buflen);
 #ifdef TEST_IDX_BUF
 	if (read == -1) read = fread(buf, 1, buflen, FileHandle);
@@ -131,10 +386,19 @@ int WebRead(UpnpWebFileHandle FileHandle, char *buf, size_t buflen)
 /*---------------------------------------------------------------------------*/
 int WebSeek(UpnpWebFileHandle FileHandle, off_t offset, int origin)
 {
+	struct sArtworkHandle *h = ArtworkHandle(FileHandle);
 	int rc;
 
 	if (!FileHandle) return -1;
 
+	if (h) {
+		if (origin == SEEK_CUR) offset += h->Pos;
+		else if (origin == SEEK_END) offset += h->Size;
+		if (offset < 0 || offset > (off_t) h->Size) return -1;
+		h->Pos = offset;
+		return 0;
+	}
+
 	rc = sq_seek(FileHandle, offset, origin);
 	if (rc == -1) rc = fseek(FileHandle, offset, origin);
 
@@ -145,8 +409,18 @@ int WebSeek(UpnpWebFileHandle FileHandle, off_t offset, int origin)
 /*---------------------------------------------------------------------------*/
 int WebClose(UpnpWebFileHandle FileHandle)
 {
+	struct sArtworkHandle *h = ArtworkHandle(FileHandle);
+
 	if (!FileHandle) return -1;
 
+	if (h) {
+		ithread_mutex_lock(&glArtworkMutex);
+		NFREE(h->Data);
+		h->InUse = false;
+		ithread_mutex_unlock(&glArtworkMutex);
+		return UPNP_E_SUCCESS;
+	}
+
 	LOG_DEBUG("webserver close", NULL);
 #ifdef TEST_IDX_BUF
 	if (!sq_close(FileHandle)) fclose(FileHandle);
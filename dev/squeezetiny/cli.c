@@ -0,0 +1,596 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2014, triode1@btinternet.com
+ *  CLI multiplexer : (c) Philippe 2015, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+One CLI connection per LMS is shared by all players. Commands are written as
+soon as a slot is free, so several can be in flight, and a reader thread
+matches each response line with the oldest pending request whose (encoded)
+command it echoes. LMS answers in order on a connection, but the echo match
+still allows unsolicited lines (listen mode) to be interleaved
+*/
+
+#include "squeezelite.h"
+
+#include <ctype.h>
+
+#define CLI_PORT		9090
+#define CLI_SERVERS		4
+#define CLI_PENDING		32
+#define CLI_BUF_MIN		4096
+#define CLI_BUF_MAX		(256*1024)
+#define CLI_POLL		100
+#define CLI_CMD_LEN		512
+#define CLI_SUBSCRIBE	"subscribe playlist"
+#define CLI_HTTPPORT	"pref httpport"
+#define HTTP_PORT		9000
+
+struct cli_request_s {
+	bool			used, done, decode;
+	bool			busy;				// callback is running, slot is not free yet
+	u32_t			seq, deadline;
+	char			cmd[CLI_CMD_LEN];	// encoded, as echoed by LMS
+	size_t			len;
+	char			*rsp;
+	cli_callback_t	callback;
+	void			*arg, *owner;
+};
+
+struct cli_s {
+	in_addr_t		ip;
+	int				users;
+	u16_t			http_port;
+	bool			running, init;
+	sockfd			sock;
+	pthread_t		thread;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	u32_t			seq;
+	struct cli_request_s	pending[CLI_PENDING];
+	char			*buf;
+	size_t			size, len;
+};
+
+static log_level 		loglevel = lWARN;
+static struct cli_s		cli_servers[CLI_SERVERS];
+static pthread_mutex_t	cli_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*---------------------------------------------------------------------------*/
+void cli_loglevel(log_level level) {
+	LOG_INFO("cli loglevel %d", level);
+	loglevel = level;
+}
+
+/*---------------------------------------------------------------------------*/
+static char from_hex(char ch) {
+  return isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10;
+}
+
+/*---------------------------------------------------------------------------*/
+static char to_hex(char code) {
+  static char hex[] = "0123456789abcdef";
+  return hex[code & 15];
+}
+
+/*---------------------------------------------------------------------------*/
+/* encode into <buf>, returns encoded length or -1 if it does not fit        */
+static int cli_encode(char *buf, char *str, size_t size) {
+  char *pstr = str, *pbuf = buf, *end = buf + size - 4;
+  while (*pstr) {
+	if (pbuf >= end) return -1;
+	if ( isalnum(*pstr) || *pstr == '-' || *pstr == '_' || *pstr == '.' ||
+						  *pstr == '~' || *pstr == ' ' || *pstr == ')' ||
+						  *pstr == '(' )
+	  *pbuf++ = *pstr;
+	else if (*pstr == '%') {
+	  *pbuf++ = '%',*pbuf++ = '2', *pbuf++ = '5';
+	}
+	else
+	  *pbuf++ = '%', *pbuf++ = to_hex(*pstr >> 4), *pbuf++ = to_hex(*pstr & 15);
+	pstr++;
+  }
+  *pbuf = '\0';
+  return pbuf - buf;
+}
+
+/*---------------------------------------------------------------------------*/
+/* decoding never grows, so it is done in place and returns <str>            */
+char *cli_decode(char *str) {
+  char *pstr = str, *pbuf = str;
+  while (*pstr) {
+	if (*pstr == '%') {
+	  if (pstr[1] && pstr[2]) {
+		*pbuf++ = from_hex(pstr[1]) << 4 | from_hex(pstr[2]);
+		pstr += 2;
+	  }
+	} else {
+	  *pbuf++ = *pstr;
+	}
+	pstr++;
+  }
+  *pbuf = '\0';
+  return str;
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+Parse a tagged status response in one pass. Items are introduced by their
+"playlist index" and stored in <items>. Keys and values are url-encoded,
+including the ':' separator, and decoded in place so <items> point inside
+<rsp> and must not be freed. Returns the item that is current (or next)
+*/
+int cli_parse_status(char *rsp, bool next, u32_t *cur, sq_metadata_t *items, int count)
+{
+	char *token, *value, *p;
+	int n = -1, target = -1, found = -1, tracks = 0;
+
+	*cur = 0;
+
+	// strtok is not re-entrant and this runs in CLI and players threads
+	for (token = rsp; token && *token; token = p) {
+		if ((p = strchr(token, ' ')) != NULL) *p++ = '\0';
+		if ((value = stristr(token, "%3a")) == NULL) continue;
+		*value = '\0';
+		value += 3;
+
+		if (!strcmp(token, "playlist_cur_index")) *cur = atoi(value);
+		else if (!strcmp(token, "playlist_tracks")) tracks = atoi(value);
+		else if (!strcmp(token, "playlist%20index")) {
+			// status header is always before the items
+			if (target < 0) target = (next && tracks) ? (*cur + 1) % tracks : *cur;
+			if (++n == count) break;
+			items[n].index = atoi(value);
+			if ((int) items[n].index == target) found = n;
+		}
+		else if (n < 0) continue;
+		else if (!strcmp(token, "title")) items[n].title = cli_decode(value);
+		else if (!strcmp(token, "artist")) items[n].artist = cli_decode(value);
+		else if (!strcmp(token, "album")) items[n].album = cli_decode(value);
+		else if (!strcmp(token, "genre")) items[n].genre = cli_decode(value);
+		else if (!strcmp(token, "url")) items[n].path = cli_decode(value);
+		else if (!strcmp(token, "coverid")) items[n].artwork = cli_decode(value);
+		else if (!strcmp(token, "duration")) items[n].duration = atol(value);
+		else if (!strcmp(token, "tracknum")) items[n].track = atol(value);
+		/*
+		filesize is not used: LMS sends the original filesize, not the
+		transcoded one, so it simply does not work
+		*/
+	}
+
+	return (found >= 0 && items[found].path) ? found : -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* LMS echoes hex escapes in lower or upper case                              */
+static bool cli_match(char *line, char *cmd, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) if (tolower(line[i]) != tolower(cmd[i])) return false;
+
+	return line[len] == ' ' || line[len] == '\0';
+}
+
+/*---------------------------------------------------------------------------*/
+/* can take a while, so cli mutex must not be locked: caller publishes socket */
+static sockfd cli_connect(struct cli_s *cli) {
+	struct sockaddr_in addr;
+	sockfd sock;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	set_nonblock(sock);
+	set_nosigpipe(sock);
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = cli->ip;
+	addr.sin_port = htons(CLI_PORT);
+
+	if (connect_timeout(sock, (struct sockaddr *) &addr, sizeof(addr), 1) != 0) {
+		LOG_ERROR("[%p]: unable to connect to CLI %s", cli, inet_ntoa(addr.sin_addr));
+		closesocket(sock);
+		return -1;
+	}
+
+	LOG_INFO("[%p]: CLI connected to %s", cli, inet_ntoa(addr.sin_addr));
+
+	// playlist changes are pushed, no response is expected
+	send_packet((u8_t*) CLI_SUBSCRIBE "\n", strlen(CLI_SUBSCRIBE) + 1, sock);
+	// web port is only needed for artwork, answer is handled as unsolicited
+	send_packet((u8_t*) CLI_HTTPPORT " ?\n", strlen(CLI_HTTPPORT) + 3, sock);
+
+	return sock;
+}
+
+/*---------------------------------------------------------------------------*/
+/* called with cli mutex locked, which is released during callbacks           */
+static void cli_complete(struct cli_s *cli, struct cli_request_s *req, char *rsp) {
+	// this is the only allocation of a request, caller parses it in place
+	if (rsp) {
+		for (rsp += req->len; *rsp == ' '; rsp++);
+		if (!*rsp) rsp = NULL;
+		else if (req->decode) rsp = cli_decode(strdup(rsp));
+		else rsp = strdup(rsp);
+	}
+
+	req->rsp = rsp;
+	req->done = true;
+
+	if (req->callback) {
+		cli_callback_t callback = req->callback;
+		void *arg = req->arg;
+
+		// callback owns the response, slot is freed once it returns so that
+		// cli_close can wait for callbacks still using its player
+		req->busy = true;
+		pthread_mutex_unlock(&cli->mutex);
+		callback(arg, rsp);
+		pthread_mutex_lock(&cli->mutex);
+		req->busy = false;
+		req->used = false;
+	}
+
+	pthread_cond_broadcast(&cli->cond);
+}
+
+/*---------------------------------------------------------------------------*/
+static void cli_fail_all(struct cli_s *cli, bool expired_only) {
+	int i;
+	u32_t now = gettime_ms();
+
+	for (i = 0; i < CLI_PENDING; i++) {
+		struct cli_request_s *req = cli->pending + i;
+
+		if (!req->used || req->done) continue;
+		if (expired_only && (s32_t) (now - req->deadline) < 0) continue;
+
+		LOG_WARN("[%p]: no response for %s", cli, req->cmd);
+		cli_complete(cli, req, NULL);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* called with cli mutex locked, notifications are "<player> playlist ..."    */
+static void cli_notify(struct cli_s *cli, char *line) {
+	char *p = strchr(line, ' ');
+	int i;
+
+	if (cli_match(line, CLI_HTTPPORT, strlen(CLI_HTTPPORT))) {
+		int port = atoi(line + strlen(CLI_HTTPPORT) + 1);
+		if (port > 0 && port < 65536) cli->http_port = port;
+		LOG_INFO("[%p]: LMS http port %u", cli, cli->http_port);
+		return;
+	}
+
+	if (!p || strncmp(p + 1, "playlist ", 9)) {
+		LOG_DEBUG("[%p]: unsolicited %s", cli, line);
+		return;
+	}
+
+	*p = '\0';
+
+	for (i = 0; i < MAX_PLAYER; i++) {
+		struct thread_ctx_s *ctx = thread_ctx + i;
+		char id[sizeof(ctx->cli_id) * 3 + 4];
+		int len;
+
+		if (!ctx->in_use || ctx->cli != cli) continue;
+
+		len = cli_encode(id, ctx->cli_id, sizeof(id));
+		if (cli_match(line, id, len)) {
+			LOG_INFO("[%p]: notification %s", ctx, p + 1);
+			pthread_mutex_unlock(&cli->mutex);
+			playlist_notify(ctx);
+			pthread_mutex_lock(&cli->mutex);
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void cli_process_line(struct cli_s *cli, char *line) {
+	struct cli_request_s *req = NULL;
+	int i;
+
+	for (i = 0; i < CLI_PENDING; i++) {
+		struct cli_request_s *p = cli->pending + i;
+
+		if (!p->used || p->done) continue;
+		if ((!req || (s32_t) (p->seq - req->seq) < 0) && cli_match(line, p->cmd, p->len)) req = p;
+	}
+
+	if (req) cli_complete(cli, req, line);
+	else cli_notify(cli, line);
+}
+
+/*---------------------------------------------------------------------------*/
+static void *cli_thread(struct cli_s *cli) {
+	struct pollfd pfd;
+
+	pthread_mutex_lock(&cli->mutex);
+
+	while (cli->running) {
+		char *p;
+		int n;
+
+		if (cli->sock < 0) {
+			sockfd sock;
+
+			// players can still queue (and fail) meanwhile
+			pthread_mutex_unlock(&cli->mutex);
+			sock = cli_connect(cli);
+			pthread_mutex_lock(&cli->mutex);
+
+			if (sock < 0) {
+				cli_fail_all(cli, false);
+				pthread_mutex_unlock(&cli->mutex);
+				usleep(1000*1000);
+				pthread_mutex_lock(&cli->mutex);
+				continue;
+			}
+
+			cli->sock = sock;
+			cli->len = 0;
+		}
+
+		pfd.fd = cli->sock;
+		pfd.events = POLLIN;
+
+		pthread_mutex_unlock(&cli->mutex);
+		n = poll(&pfd, 1, CLI_POLL);
+		pthread_mutex_lock(&cli->mutex);
+
+		cli_fail_all(cli, true);
+
+		if (n <= 0 || !cli->running) continue;
+
+		if (cli->len == cli->size - 1) {
+			if (cli->size >= CLI_BUF_MAX) {
+				LOG_ERROR("[%p]: CLI line too long, dropped", cli);
+				cli->len = 0;
+			} else {
+				cli->size *= 2;
+				cli->buf = realloc(cli->buf, cli->size);
+			}
+		}
+
+		n = recv(cli->sock, cli->buf + cli->len, cli->size - 1 - cli->len, 0);
+
+		if (n <= 0) {
+			if (n < 0 && last_error() == ERROR_WOULDBLOCK) continue;
+			LOG_WARN("[%p]: CLI connection closed", cli);
+			closesocket(cli->sock);
+			cli->sock = -1;
+			cli_fail_all(cli, false);
+			continue;
+		}
+
+		cli->len += n;
+		cli->buf[cli->len] = '\0';
+
+		// process all complete lines then keep the partial one
+		while ((p = strchr(cli->buf, '\n')) != NULL) {
+			*p = '\0';
+			if (p > cli->buf && *(p-1) == '\r') *(p-1) = '\0';
+			cli_process_line(cli, cli->buf);
+			cli->len -= p + 1 - cli->buf;
+			memmove(cli->buf, p + 1, cli->len + 1);
+		}
+	}
+
+	if (cli->sock >= 0) closesocket(cli->sock);
+	cli->sock = -1;
+	cli_fail_all(cli, false);
+
+	// release callers waiting for a slot
+	pthread_cond_broadcast(&cli->cond);
+
+	pthread_mutex_unlock(&cli->mutex);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct cli_request_s *cli_queue(struct cli_s *cli, char *cmd, bool req, bool decode, cli_callback_t callback, void *arg, struct thread_ctx_s *ctx) {
+	struct cli_request_s *slot = NULL;
+	char packet[CLI_CMD_LEN + 4];
+	bool full = false;
+	int i, len;
+
+	if ((len = cli_encode(packet, cmd, CLI_CMD_LEN)) < 0) {
+		LOG_ERROR("[%p]: CLI command too long %s", ctx, cmd);
+		if (callback) callback(arg, NULL);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cli->mutex);
+
+	// wait for a free slot (requests time out so this is bounded) but async
+	// requests might come from the CLI thread itself so they never wait
+	while (cli->running && cli->sock >= 0) {
+		for (i = 0; i < CLI_PENDING && cli->pending[i].used; i++);
+		if (i < CLI_PENDING) {
+			slot = cli->pending + i;
+			break;
+		}
+		if (callback) {
+			full = true;
+			break;
+		}
+		pthread_cond_wait(&cli->cond, &cli->mutex);
+	}
+
+	if (!slot) {
+		pthread_mutex_unlock(&cli->mutex);
+		if (full) LOG_ERROR("[%p]: CLI queue full for %s", ctx, cmd);
+		else LOG_ERROR("[%p]: CLI not connected for %s", ctx, cmd);
+		// async caller is always completed, so it can release or retry
+		if (callback) callback(arg, NULL);
+		return NULL;
+	}
+
+	slot->used = true;
+	slot->done = false;
+	slot->decode = decode;
+	slot->rsp = NULL;
+	slot->callback = callback;
+	slot->arg = arg;
+	slot->owner = ctx;
+	slot->seq = cli->seq++;
+	slot->deadline = gettime_ms() + ctx->config.max_read_wait * 10;
+	slot->len = len;
+	memcpy(slot->cmd, packet, len + 1);
+
+	len += sprintf(packet + len, req ? " ?\n" : "\n");
+	send_packet((u8_t*) packet, len, cli->sock);
+
+	LOG_DEBUG("[%p]: CLI sent %s (seq:%u)", ctx, cmd, slot->seq);
+
+	pthread_mutex_unlock(&cli->mutex);
+
+	return slot;
+}
+
+/*---------------------------------------------------------------------------*/
+char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx) {
+	struct cli_s *cli = ctx->cli;
+	struct cli_request_s *slot;
+	char *rsp;
+
+	if (!cli || (slot = cli_queue(cli, cmd, req, decode, NULL, NULL, ctx)) == NULL) return NULL;
+
+	pthread_mutex_lock(&cli->mutex);
+	while (!slot->done) pthread_cond_wait(&cli->cond, &cli->mutex);
+	rsp = slot->rsp;
+	slot->used = false;
+	pthread_cond_broadcast(&cli->cond);
+	pthread_mutex_unlock(&cli->mutex);
+
+	return rsp;
+}
+
+/*---------------------------------------------------------------------------*/
+/* callback runs in the CLI thread: it must not make blocking CLI calls       */
+/* when request cannot be sent, it has been called with NULL when returning   */
+bool cli_send_cmd_async(char *cmd, bool req, bool decode, cli_callback_t callback, void *arg, struct thread_ctx_s *ctx) {
+	struct cli_s *cli = ctx->cli;
+
+	if (!cli) {
+		if (callback) callback(arg, NULL);
+		return false;
+	}
+
+	// slot is then owned and released by the CLI thread
+	return cli_queue(cli, cmd, req, decode, callback, arg, ctx) != NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+u16_t cli_http_port(struct thread_ctx_s *ctx) {
+	return ctx->cli ? ctx->cli->http_port : HTTP_PORT;
+}
+
+/*---------------------------------------------------------------------------*/
+void cli_open(struct thread_ctx_s *ctx) {
+	struct cli_s *cli = NULL;
+	int i;
+
+	// already attached to this server
+	if (ctx->cli && ctx->cli->ip == ctx->slimproto_ip) return;
+
+	cli_close(ctx);
+
+	pthread_mutex_lock(&cli_mutex);
+
+	for (i = 0; i < CLI_SERVERS; i++) {
+		if (cli_servers[i].users && cli_servers[i].ip == ctx->slimproto_ip) {
+			cli = cli_servers + i;
+			break;
+		}
+		if (!cli && !cli_servers[i].users) cli = cli_servers + i;
+	}
+
+	if (!cli) {
+		pthread_mutex_unlock(&cli_mutex);
+		LOG_ERROR("[%p]: too many servers for CLI", ctx);
+		return;
+	}
+
+	if (!cli->users++) {
+		cli->ip = ctx->slimproto_ip;
+		cli->running = true;
+		cli->sock = -1;
+		cli->http_port = HTTP_PORT;
+		cli->size = CLI_BUF_MIN;
+		cli->buf = malloc(cli->size);
+		cli->len = 0;
+		memset(cli->pending, 0, sizeof(cli->pending));
+
+		// never destroyed as players might still hold a stale reference
+		if (!cli->init) {
+			pthread_mutex_init(&cli->mutex, NULL);
+			pthread_cond_init(&cli->cond, NULL);
+			cli->init = true;
+		}
+
+		// connect now so that first commands do not fail
+		cli->sock = cli_connect(cli);
+		pthread_create(&cli->thread, NULL, (void *(*)(void*)) &cli_thread, cli);
+	}
+
+	ctx->cli = cli;
+
+	pthread_mutex_unlock(&cli_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void cli_close(struct thread_ctx_s *ctx) {
+	struct cli_s *cli = ctx->cli;
+	int i;
+
+	if (!cli) return;
+
+	pthread_mutex_lock(&cli_mutex);
+
+	// async requests of that player must not complete once it is gone
+	pthread_mutex_lock(&cli->mutex);
+	for (i = 0; i < CLI_PENDING; i++) {
+		struct cli_request_s *req = cli->pending + i;
+		if (req->used && !req->done && req->callback && req->owner == ctx) cli_complete(cli, req, NULL);
+	}
+
+	// and callbacks already running in CLI thread must be done with it
+	for (i = 0; i < CLI_PENDING; i++) {
+		struct cli_request_s *req = cli->pending + i;
+		if (req->busy && req->owner == ctx) {
+			pthread_cond_wait(&cli->cond, &cli->mutex);
+			i = -1;
+		}
+	}
+	pthread_mutex_unlock(&cli->mutex);
+
+	ctx->cli = NULL;
+
+	if (!--cli->users) {
+		pthread_mutex_lock(&cli->mutex);
+		cli->running = false;
+		pthread_mutex_unlock(&cli->mutex);
+		pthread_join(cli->thread, NULL);
+		NFREE(cli->buf);
+	}
+
+	pthread_mutex_unlock(&cli_mutex);
+}
@@ -87,11 +87,13 @@ static unsigned 		gl_dop_delay = 0;
 #endif
 static char				gl_include_codecs[SQ_STR_LENGTH];
 static char				gl_exclude_codecs[SQ_STR_LENGTH];
+static hash_t			gl_urn_index;		// buf_name => out_ctx
 
 /*----------------------------------------------------------------------------*/
 /* locals */
 /*----------------------------------------------------------------------------*/
 static void sq_wipe_device(struct thread_ctx_s *ctx);
+static out_ctx_t *urn2out(const char *urn);
 
 static log_level	loglevel = lWARN;
 
@@ -103,9 +105,11 @@ void sq_stop(void) {
 		if (thread_ctx[i].in_use) {
 			sq_wipe_device(&thread_ctx[i]);
 		}
-	}
-#if WIN
-	winsock_close();
+	}
+	metacache_close();
+	hash_free(&gl_urn_index);
+#if WIN
+	winsock_close();
 #endif
 }
 
@@ -125,6 +129,7 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 		if (ctx->out_ctx[i].write_file) fclose (ctx->out_ctx[i].write_file);
 		sprintf(buf, "%s/%s", ctx->config.buffer_dir, ctx->out_ctx[i].buf_name);
 		remove(buf);
+		hash_del(&gl_urn_index, ctx->out_ctx[i].buf_name, ctx->out_ctx + i);
 		ctx->out_ctx[i].read_file = ctx->out_ctx[i].write_file = NULL;
 		ctx->out_ctx[i].owner = NULL;
 
@@ -141,142 +146,36 @@ void sq_delete_device(sq_dev_handle_t handle) {
 void main_loglevel(log_level level)
 {
 	LOG_WARN("main change log", NULL);
-	loglevel = level;
+	loglevel = level;
+	cli_loglevel(level);
 }
 
 /*---------------------------------------------------------------------------*/
-void *sq_urn2MR(const char *urn)
-{
-	int i = 0;
-	out_ctx_t *out = NULL;
-
-	for (i = 0; i < MAX_PLAYER && !out; i++) {
-		if (!thread_ctx[i].in_use) continue;
-		if (strstr(urn, thread_ctx[i].out_ctx[0].buf_name)) out = &thread_ctx[i].out_ctx[0];
-		if (strstr(urn, thread_ctx[i].out_ctx[1].buf_name)) out = &thread_ctx[i].out_ctx[1];
-	}
-
-	return (out) ? thread_ctx[i-1].MR : NULL;
-}
+static out_ctx_t *urn2out(const char *urn)
+{
+	// urn embeds buf_name "xx-xx-xx-xx-xx-xx-idx-N", extract it as index key
+	char key[sizeof("xx-xx-xx-xx-xx-xx-idx-N")];
+	char *p = strstr(urn, "-idx-");
+	out_ctx_t *out;
 
-/*---------------------------------------------------------------------------*/
-static char from_hex(char ch) {
-  return isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10;
-}
+	if (!p || p - urn < 17 || !p[5]) return NULL;
 
-/*---------------------------------------------------------------------------*/
-static char to_hex(char code) {
-  static char hex[] = "0123456789abcdef";
-  return hex[code & 15];
-}
+	strncpy(key, p - 17, sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	out = hash_get(&gl_urn_index, key);
 
-/*---------------------------------------------------------------------------*/
-/* IMPORTANT: be sure to free() the returned string after use */
-static char *cli_encode(char *str) {
-  char *pstr = str, *buf = malloc(strlen(str) * 3 + 1), *pbuf = buf;
-  while (*pstr) {
-	if ( isalnum(*pstr) || *pstr == '-' || *pstr == '_' || *pstr == '.' ||
-						  *pstr == '~' || *pstr == ' ' || *pstr == ')' ||
-						  *pstr == '(' )
-	  *pbuf++ = *pstr;
-	else if (*pstr == '%') {
-	  *pbuf++ = '%',*pbuf++ = '2', *pbuf++ = '5';
-	}
-	else
-	  *pbuf++ = '%', *pbuf++ = to_hex(*pstr >> 4), *pbuf++ = to_hex(*pstr & 15);
-	pstr++;
-  }
-  *pbuf = '\0';
-  return buf;
+	return (out && out->owner && out->owner->in_use) ? out : NULL;
 }
 
 /*---------------------------------------------------------------------------*/
-/* IMPORTANT: be sure to free() the returned string after use */
-static char *cli_decode(char *str) {
-  char *pstr = str, *buf = malloc(strlen(str) + 1), *pbuf = buf;
-  while (*pstr) {
-	if (*pstr == '%') {
-	  if (pstr[1] && pstr[2]) {
-		*pbuf++ = from_hex(pstr[1]) << 4 | from_hex(pstr[2]);
-		pstr += 2;
-	  }
-	} else {
-	  *pbuf++ = *pstr;
-	}
-	pstr++;
-  }
-  *pbuf = '\0';
-  return buf;
-}
+void *sq_urn2MR(const char *urn)
+{
+	out_ctx_t *out = urn2out(urn);
 
-/*---------------------------------------------------------------------------*/
-/* IMPORTANT: be sure to free() the returned string after use */
-static char *cli_find_tag(char *str, char *tag)
-{
-	char *p, *res = NULL;
-	char *buf = malloc(strlen(str));
-
-	strcpy(buf, tag);
-	strcat(buf, "%3a");
-	if ((p = stristr(str, buf))) {
-		int i = 0;
-		p += strlen(buf);
-		while (*(p+i) != ' ' && *(p+i) != '\n' && *(p+i)) i++;
-		if (i) {
-			strncpy(buf, p, i);
-			buf[i] = '\0';
-			res = url_decode(buf);
-		}
-	}
-	free(buf);
-	return res;
+	return (out) ? out->owner->MR : NULL;
 }
 
-/*---------------------------------------------------------------------------*/
-char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx)
-{
-	char packet[1024];
-	int wait;
-	size_t len;
-	char *rsp = NULL;
-
-	mutex_lock(ctx->cli_mutex);
-    wait = ctx->config.max_read_wait;
-
-	cmd = cli_encode(cmd);
-	if (req) len = sprintf(packet, "%s ?\n", cmd);
-	else len = sprintf(packet, "%s\n", cmd);
-	send_packet((u8_t*) packet, len, ctx->cli_sock);
-
-	// first receive the tag and then point to the last '\n'
-	len = 0;
-	while (wait--)	{
-		int k;
-		usleep(10000);
-		k = recv(ctx->cli_sock, packet + len, 1024-1 - len, 0);
-		if (k < 0) continue;
-		len += k;
-		packet[len] = '\0';
-		if (strchr(packet, '\n') && stristr(packet, cmd)) {
-			rsp = packet;
-			break;
-		}
-	}
-
-	if (rsp) {
-		for (rsp += strlen(cmd); *rsp == ' '; rsp++);
-		if (decode) rsp = cli_decode(rsp);
-		else rsp = strdup(rsp);
-		*(strrchr(rsp, '\n')) = '\0';
-		if (*rsp == '\0') NFREE(rsp);
-	}
-
-	NFREE(cmd);
-	mutex_unlock(ctx->cli_mutex);
-	return rsp;
-}
-
-/*--------------------------------------------------------------------------*/
+/*--------------------------------------------------------------------------*/
 u32_t sq_get_time(sq_dev_handle_t handle)
 {
 	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
@@ -284,7 +183,7 @@ u32_t sq_get_time(sq_dev_handle_t handle)
 	char *rsp;
 	u32_t time = 0;
 
-	if (!handle || !ctx->cli_sock) {
+	if (!handle || !ctx->cli) {
 		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
 		return 0;
 	}
@@ -310,7 +209,7 @@ bool sq_set_time(sq_dev_handle_t handle, u32_t time)
 	char *rsp;
 	bool rc = false;
 
-	if (!handle || !ctx->cli_sock) {
+	if (!handle || !ctx->cli) {
 		LOG_ERROR("[%p]: no handle or cli socket %d", ctx, handle);
 		return false;
 	}
@@ -330,6 +229,43 @@ bool sq_set_time(sq_dev_handle_t handle, u32_t time)
 	return rc;
 }
 
+/*---------------------------------------------------------------------------*/
+static void seek_resume_callback(void *arg, char *rsp)
+{
+	struct thread_ctx_s *ctx = (struct thread_ctx_s*) arg;
+
+	// no answer (timeout, LMS gone, queue full): resume anyway, without the seek
+	if (!rsp) LOG_ERROR("[%p] cannot seek on resume, resuming at pause point", ctx);
+	NFREE(rsp);
+
+	/*
+	This runs in the CLI thread shared by all players and the controller
+	callback takes the device mutex, so Play is issued by the player thread
+	*/
+	player_event(ctx, EV_RESUME);
+}
+
+/*---------------------------------------------------------------------------*/
+bool sq_seek_resume(sq_dev_handle_t handle)
+{
+	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	char cmd[128];
+
+	if (!handle || !ctx->cli) {
+		LOG_ERROR("[%p]: no handle or cli socket %d", ctx, handle);
+		return false;
+	}
+
+	// this is the elapsed time reported to LMS, no need to ask it back
+	sprintf(cmd, "%s time %.1lf", ctx->cli_id, (double) ctx->status.ms_played / 1000);
+	LOG_INFO("[%p] seek on resume %u", ctx, ctx->status.ms_played);
+
+	// callback is always called, even when request cannot be sent, and resumes
+	cli_send_cmd_async(cmd, false, true, seek_resume_callback, ctx, ctx);
+
+	return true;
+}
+
 /*--------------------------------------------------------------------------*/
 static void sq_init_metadata(sq_metadata_t *metadata)
 {
@@ -346,6 +282,21 @@ static void sq_init_metadata(sq_metadata_t *metadata)
 	metadata->duration = 0;
 }
 
+/*--------------------------------------------------------------------------*/
+void sq_copy_metadata(sq_metadata_t *dst, sq_metadata_t *src)
+{
+	dst->artist = src->artist ? strdup(src->artist) : NULL;
+	dst->album = src->album ? strdup(src->album) : NULL;
+	dst->title = src->title ? strdup(src->title) : NULL;
+	dst->genre = src->genre ? strdup(src->genre) : NULL;
+	dst->path = src->path ? strdup(src->path) : NULL;
+	dst->artwork = src->artwork ? strdup(src->artwork) : NULL;
+	dst->index = src->index;
+	dst->track = src->track;
+	dst->duration = src->duration;
+	dst->file_size = src->file_size;
+}
+
 /*--------------------------------------------------------------------------*/
 void sq_default_metadata(sq_metadata_t *metadata, bool init)
 {
@@ -359,99 +310,179 @@ void sq_default_metadata(sq_metadata_t *metadata, bool init)
 	if (!metadata->artwork) metadata->artwork = strdup("[no artwork]");
 }
 
+#define STATUS_TAGS		"acdgltu"
+#define ARTWORK_SIZE	"500x500"
+
 /*--------------------------------------------------------------------------*/
-bool sq_get_metadata(sq_dev_handle_t handle, sq_metadata_t *metadata, bool next)
+static bool sq_query_metadata(char *cmd, bool next, sq_metadata_t *metadata, struct thread_ctx_s *ctx)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
-	char cmd[1024];
-	char *rsp, *p;
-	u16_t idx;
+	sq_metadata_t items[STATUS_ITEMS];
+	char *rsp;
+	int i, found = -1;
+	u32_t cur = 0;
 
-	if (!handle || !ctx->cli_sock) {
-		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
-		sq_default_metadata(metadata, true);
-		return false;
-	}
+	for (i = 0; i < STATUS_ITEMS; i++) sq_init_metadata(items + i);
 
-	sprintf(cmd, "%s playlist index", ctx->cli_id);
-	rsp = cli_send_cmd(cmd, true, true, ctx);
+	rsp = cli_send_cmd(cmd, false, false, ctx);
+	if (rsp) found = cli_parse_status(rsp, next, &cur, items, STATUS_ITEMS);
 
-	if (!rsp) {
-		LOG_ERROR("[%p]: missing index", ctx);
-		sq_default_metadata(metadata, true);
-		return false;
+	// all items are cached, next one is likely to be asked later
+	for (i = 0; i < STATUS_ITEMS; i++) {
+		if (items[i].path && *items[i].path) metacache_put(items + i);
 	}
 
-	sq_init_metadata(metadata);
-
-	idx = atol(rsp);
+	if (found >= 0) sq_copy_metadata(metadata, items + found);
+	else metadata->index = cur;
 	NFREE(rsp);
-	metadata->index = idx;
-
-	if (next) {
-		sprintf(cmd, "%s playlist tracks", ctx->cli_id);
-		rsp = cli_send_cmd(cmd, true, true, ctx);
-		if (rsp && atol(rsp)) idx = (idx + 1) % atol(rsp);
-		else idx = 0;
-		NFREE(rsp);
-	}
 
-	sprintf(cmd, "%s playlist path %d", ctx->cli_id, idx);
-	metadata->path = cli_send_cmd(cmd, true, true, ctx);
+	return found >= 0;
+}
 
-	sprintf(cmd, "songinfo 0 10 url:%s tags:cfldatgr", metadata->path);
-	rsp = cli_send_cmd(cmd, false, false, ctx);
+/*--------------------------------------------------------------------------*/
+void playlist_invalidate(struct thread_ctx_s *ctx)
+{
+	int i;
+
+	LOCK_P;
+	ctx->playlist.gen++;
+	ctx->playlist.valid = false;
+	for (i = 0; i < STATUS_ITEMS; i++) NFREE(ctx->playlist.path[i]);
+	UNLOCK_P;
+}
+
+/*--------------------------------------------------------------------------*/
+struct prefetch_s {
+	struct thread_ctx_s *ctx;
+	u32_t	gen;
+};
+
+static void prefetch_callback(void *arg, char *rsp)
+{
+	struct prefetch_s *prefetch = (struct prefetch_s*) arg;
+	struct thread_ctx_s *ctx = prefetch->ctx;
+	sq_metadata_t items[STATUS_ITEMS];
+	int i, found = -1;
+	u32_t cur = 0;
+	bool ordered = false;
+
+	for (i = 0; i < STATUS_ITEMS; i++) sq_init_metadata(items + i);
 
 	if (rsp) {
-		metadata->title = cli_find_tag(rsp, "title");
-		metadata->artist = cli_find_tag(rsp, "artist");
-		metadata->album = cli_find_tag(rsp, "album");
-		metadata->genre = cli_find_tag(rsp, "genre");
-		if ((p = cli_find_tag(rsp, "duration"))) {
-			metadata->duration = atol(p);
-			free(p);
-		}
-		if ((p = cli_find_tag(rsp, "filesize"))) {
-			metadata->file_size = atol(p);
-			/*
-			at this point, LMS sends the original filesize, not the transcoded
-			so it simply does not work
-        	*/
-			metadata->file_size = 0;
-			free(p);
-		}
-		if ((p = cli_find_tag(rsp, "tracknum"))) {
-			metadata->track = atol(p);
-			free(p);
-		}
-		if ((p = cli_find_tag(rsp, "coverid"))) {
-			// some changes to do on the coverid for form an URL
-			metadata->artwork = p;
+		// the item after the current one is the next to play only then
+		ordered = stristr(rsp, "playlist%20shuffle%3a0") && !stristr(rsp, "playlist%20repeat%3a1");
+		found = cli_parse_status(rsp, false, &cur, items, STATUS_ITEMS);
+	}
+
+	if (found >= 0) {
+		LOCK_P;
+		// a playlist change or a flush happened meanwhile, this is stale
+		if (prefetch->gen == ctx->playlist.gen) {
+			for (i = 0; i < STATUS_ITEMS; i++) {
+				NFREE(ctx->playlist.path[i]);
+				// only consecutive items from the current one (no wrap)
+				if (found + i < STATUS_ITEMS && items[found + i].path &&
+					items[found + i].index == cur + i)
+					ctx->playlist.path[i] = strdup(items[found + i].path);
+			}
+			ctx->playlist.index = cur;
+			ctx->playlist.ordered = ordered;
+			ctx->playlist.valid = true;
 		}
+		UNLOCK_P;
 	}
-	else {
-		LOG_INFO("[%p]: no metadata using songinfo", ctx, idx);
+
+	for (i = 0; i < STATUS_ITEMS; i++) {
+		if (items[i].path && *items[i].path) metacache_put(items + i);
+	}
+
+	LOG_DEBUG("[%p]: prefetched from %u (found:%d)", ctx, cur, found);
+
+	NFREE(rsp);
+	free(prefetch);
+}
+
+/*--------------------------------------------------------------------------*/
+void playlist_notify(struct thread_ctx_s *ctx)
+{
+	struct prefetch_s *prefetch = malloc(sizeof(struct prefetch_s));
+	char cmd[128];
+
+	// any playlist change (including newsong) makes snapshot obsolete
+	playlist_invalidate(ctx);
+
+	prefetch->ctx = ctx;
+	prefetch->gen = ctx->playlist.gen;
+
+	sprintf(cmd, "%s status - %d tags:%s", ctx->cli_id, STATUS_ITEMS, STATUS_TAGS);
+	// prefetch is released by the callback, even when request is not sent
+	cli_send_cmd_async(cmd, false, false, prefetch_callback, prefetch, ctx);
+}
+
+/*--------------------------------------------------------------------------*/
+bool sq_get_metadata(sq_dev_handle_t handle, sq_metadata_t *metadata, bool next)
+{
+	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	char cmd[1024];
+	bool found = false;
+	int slot = next ? 1 : 0;
 
-		sprintf(cmd, "%s playlist title %d", ctx->cli_id, idx);
-		metadata->title = cli_send_cmd(cmd, true, true, ctx);
+	if (!handle || !ctx->cli) {
+		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
+		sq_default_metadata(metadata, true);
+		return false;
+	}
+
+	sq_init_metadata(metadata);
+
+	/*
+	Playlist prefetched after a notification, no CLI round trip at all. It
+	only holds consecutive items from the current one, so the next item is
+	at index + 1 unless LMS shuffles or repeats the song (or wraps around)
+	*/
+	LOCK_P;
+	if (ctx->playlist.valid && ctx->playlist.path[slot] && (!next || ctx->playlist.ordered)) {
+		found = metacache_get(ctx->playlist.path[slot], metadata);
+		metadata->index = ctx->playlist.index + slot;
+	}
+	UNLOCK_P;
+
+	/*
+	Current and next items with all their tags, "-" being the current index.
+	Asking for urls first would cost a second round trip on every new track,
+	so a single full query is done and fills the cache for the next ones
+	*/
+	if (!found) {
+		sprintf(cmd, "%s status - %d tags:%s", ctx->cli_id, STATUS_ITEMS, STATUS_TAGS);
+		found = sq_query_metadata(cmd, next, metadata, ctx);
+	}
 
-		sprintf(cmd, "%s playlist album %d", ctx->cli_id, idx);
-		metadata->album = cli_send_cmd(cmd, true, true, ctx);
+	// next of last item is the first one
+	if (!found && next && metadata->index) {
+		sprintf(cmd, "%s status 0 1 tags:%s", ctx->cli_id, STATUS_TAGS);
+		found = sq_query_metadata(cmd, next, metadata, ctx);
+	}
 
-		sprintf(cmd, "%s playlist artist %d", ctx->cli_id, idx);
-		metadata->artist = cli_send_cmd(cmd, true, true, ctx);
+	if (!found) {
+		LOG_ERROR("[%p]: no metadata from status", ctx);
+		sq_free_metadata(metadata);
+		sq_default_metadata(metadata, true);
+		return false;
+	}
 
-		sprintf(cmd, "%s playlist genre %d", ctx->cli_id, idx);
-		metadata->genre = cli_send_cmd(cmd, true, true, ctx);
+	// cache holds the coverid, players need a full LMS url
+	if (metadata->artwork && *metadata->artwork && strncmp(metadata->artwork, "http", 4)) {
+		struct in_addr addr;
 
-		sprintf(cmd, "%s playlist duration %d", ctx->cli_id, idx);
-		rsp = cli_send_cmd(cmd, true, true, ctx);
-		if (rsp) metadata->duration = atol(rsp);
+		addr.s_addr = ctx->slimproto_ip;
+		sprintf(cmd, "http://%s:%u/music/%s/cover_%s.jpg", inet_ntoa(addr), cli_http_port(ctx),
+				metadata->artwork, ARTWORK_SIZE);
+		free(metadata->artwork);
+		metadata->artwork = strdup(cmd);
 	}
-	NFREE(rsp);
+
 	sq_default_metadata(metadata, false);
 
-	LOG_INFO("[%p]: idx %d\n\tartist:%s\n\talbum:%s\n\ttitle:%s\n\tgenre:%s\n\tduration:%d\n\tsize:%d", ctx, idx,
+	LOG_INFO("[%p]: idx %d (next:%d)\n\tartist:%s\n\talbum:%s\n\ttitle:%s\n\tgenre:%s\n\tduration:%d\n\tsize:%d", ctx, metadata->index, next,
 				metadata->artist, metadata->album, metadata->title,
 				metadata->genre, metadata->duration, metadata->file_size);
 
@@ -470,24 +501,17 @@ void sq_free_metadata(sq_metadata_t *metadata)
 }
 
 /*---------------------------------------------------------------------------*/
-void *sq_get_info(const char *urn, s32_t *size, char **content_type)
-{
-	int i = 0;
-	out_ctx_t *out = NULL;
-	char *p;
-
-	for (i = 0; i < MAX_PLAYER && !out; i++) {
-		if (!thread_ctx[i].in_use) continue;
-		if (strstr(urn, thread_ctx[i].out_ctx[0].buf_name)) out = &thread_ctx[i].out_ctx[0];
-		if (strstr(urn, thread_ctx[i].out_ctx[1].buf_name)) out = &thread_ctx[i].out_ctx[1];
-	}
-
-	if (out) {
+void *sq_get_info(const char *urn, s32_t *size, char **content_type)
+{
+	out_ctx_t *out = urn2out(urn);
+	char *p;
+
+	if (out) {
 		p = malloc(strlen(out->content_type) + 1);
 		strcpy(p, out->content_type);
 		*size = out->file_size;
 		*content_type = p;
-		return &thread_ctx[i];
+		return out->owner;
 	}
 	else {
 		*content_type = strdup("audio/unknown");
@@ -497,16 +521,9 @@ void *sq_get_info(const char *urn, s32_t *size, char **content_type)
 
 
 /*---------------------------------------------------------------------------*/
-void *sq_open(const char *urn)
-{
-	int i = 0;
-	out_ctx_t *out = NULL;
-
-	for (i = 0; i < MAX_PLAYER && !out; i++) {
-		if (!thread_ctx[i].in_use) continue;
-		if (strstr(urn, thread_ctx[i].out_ctx[0].buf_name)) out = &thread_ctx[i].out_ctx[0];
-		if (strstr(urn, thread_ctx[i].out_ctx[1].buf_name)) out = &thread_ctx[i].out_ctx[1];
-	}
+void *sq_open(const char *urn)
+{
+	out_ctx_t *out = urn2out(urn);
 
 	if (out) {
 		char buf[SQ_STR_LENGTH];
@@ -515,7 +532,7 @@ void *sq_open(const char *urn)
 		LOCK_S;LOCK_O;
 		if (!out->read_file) {
 			// read counters are not set here. they are set 
-			sprintf(buf, "%s/%s", thread_ctx[i-1].config.buffer_dir, out->buf_name);
+			sprintf(buf, "%s/%s", ctx->config.buffer_dir, out->buf_name);
 			out->read_file = fopen(buf, "rb");
 			LOG_INFO("[%p]: open", out->owner);
 			if (!out->read_file) out = NULL;
@@ -529,17 +546,9 @@ void *sq_open(const char *urn)
 }
 
 /*---------------------------------------------------------------------------*/
-void *sq_isopen(const char *urn)
-{
-	int i = 0;
-	out_ctx_t *out = NULL;
-
-
-	for (i = 0; i < MAX_PLAYER && !out; i++) {
-		if (!thread_ctx[i].in_use) continue;
-		if (strstr(urn, thread_ctx[i].out_ctx[0].buf_name)) out = &thread_ctx[i].out_ctx[0];
-		if (strstr(urn, thread_ctx[i].out_ctx[1].buf_name)) out = &thread_ctx[i].out_ctx[1];
-	}
+void *sq_isopen(const char *urn)
+{
+	out_ctx_t *out = urn2out(urn);
 
 	if (out) return out->read_file;
 	else return NULL;
@@ -669,15 +678,14 @@ int sq_read(void *desc, void *dst, unsigned bytes)
 	*/
 	if (wait && !read_b && !p->write_file) {
 #ifndef __EARLY_STMd__
-		ctx->read_ended = true;
-		wake_controller(ctx);
+		player_event(ctx, EV_READ_ENDED);
 #endif
 		LOG_INFO("[%p]: read (end of track) w:%d", ctx, wait);
 	}
 
 	// exit on timeout and not read enough data ==> underrun
 	if (!wait && !read_b) {
-		ctx->read_to = true;
+		player_event(ctx, EV_READ_TIMEOUT);
 		LOG_ERROR("[%p]: underrun read:%d (r:%d)", ctx, read_b, bytes);
 	}
 	UNLOCK_S;UNLOCK_O;
@@ -716,11 +724,8 @@ int sq_read(void *desc, void *dst, unsigned bytes)
 				Be careful of what is done here in case the "playing" event if
 				an extra one generated by an unwanted stop or a lack of NextURI cap
 				*/
-				LOCK_S;
 				LOG_INFO("[%p] uPNP playing notif", ctx);
-				ctx->play_running = true;
-				UNLOCK_S;
-				wake_controller(ctx);
+				player_event(ctx, EV_PLAYING);
 			}
 			break;
 		case SQ_PAUSE: {
@@ -734,13 +739,7 @@ int sq_read(void *desc, void *dst, unsigned bytes)
 		}
 		case SQ_STOP:
 			LOG_INFO("[%p] uPNP notify STOP", ctx);
-			LOCK_S;
-			if (ctx->play_running) {
-				ctx->track_ended = true;
-			 }
-			ctx->play_running = false;
-			UNLOCK_S;
-			wake_controller(ctx);
+			player_event(ctx, EV_STOPPED);
 			break;
 		case SQ_SEEK: break;
 		case SQ_VOLUME: break;
@@ -752,14 +751,7 @@ int sq_read(void *desc, void *dst, unsigned bytes)
 			break;
 		}
 		case SQ_TRACK_CHANGE:
-			LOCK_S;
-			if (ctx->play_running) {
-				LOG_INFO("[%p] End of track by track change", ctx);
-				ctx->ms_played = 0;
-				ctx->track_new = true;
-				wake_controller(ctx);
-			}
-			UNLOCK_S;
+			player_event(ctx, EV_TRACK_CHANGE);
 			break;
 
 		default: break;
@@ -767,7 +759,16 @@ int sq_read(void *desc, void *dst, unsigned bytes)
  }
 
 /*---------------------------------------------------------------------------*/
-void sq_init(char *server, u8_t mac[6], sq_log_level_t *log)
+void sq_set_codecs(sq_dev_handle_t handle, char *codecs)
+{
+	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+
+	if (!handle || !ctx->running) return;
+	slimproto_set_codecs(ctx, codecs);
+}
+
+/*---------------------------------------------------------------------------*/
+void sq_init(char *server, u8_t mac[6], sq_log_level_t *log)
 {
 	if (server) {
 		strcpy(_gl_server, server);
@@ -794,6 +795,9 @@ int sq_read(void *desc, void *dst, unsigned bytes)
 #endif
 
 	loglevel = log->general;
+	metacache_init();
+	hash_init(&gl_urn_index, 4*MAX_PLAYER);
+	cli_loglevel(log->general);
 	slimproto_loglevel(log->slimproto);
 	stream_loglevel(log->stream);
 //	output_init(gl_log.output, true);
@@ -881,6 +885,7 @@ bool sq_run_device(sq_dev_handle_t handle, char *name, sq_dev_param_t *param)
 		ctx->out_ctx[i].owner = ctx;
 		ctx->out_ctx[i].idx = i;
 		strcpy(ctx->out_ctx[i].content_type, "audio/unknown");
+		hash_put(&gl_urn_index, ctx->out_ctx[i].buf_name, ctx->out_ctx + i);
 	}
 
 	memcpy(&ctx->config, param, sizeof(sq_dev_param_t));
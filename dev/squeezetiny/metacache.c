@@ -0,0 +1,123 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2014, triode1@btinternet.com
+ *  Metadata cache : (c) Philippe 2015, philippe_44@outlook.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+Track metadata shared by all players, keyed by LMS url (path). Entries expire
+after METACACHE_TTL and the least recently used one is evicted when full. Radio
+streams are not cached as their title changes while playing
+*/
+
+#include "squeezelite.h"
+
+#define METACACHE_SIZE	64
+#define METACACHE_TTL	(15*60*1000)
+
+static struct {
+	sq_metadata_t	metadata;
+	u32_t			expires, last;
+} cache[METACACHE_SIZE];
+
+static mutex_type	cache_mutex;
+static u32_t		cache_hits, cache_misses;
+
+/*---------------------------------------------------------------------------*/
+void metacache_init(void) {
+	memset(cache, 0, sizeof(cache));
+	cache_hits = cache_misses = 0;
+	mutex_create(cache_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void metacache_close(void) {
+	int i;
+
+	mutex_lock(cache_mutex);
+	for (i = 0; i < METACACHE_SIZE; i++) sq_free_metadata(&cache[i].metadata);
+	mutex_unlock(cache_mutex);
+	mutex_destroy(cache_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+bool metacache_get(char *path, sq_metadata_t *metadata) {
+	u32_t now = gettime_ms();
+	int i;
+
+	if (!path || !strncmp(path, "http", 4)) return false;
+
+	mutex_lock(cache_mutex);
+
+	for (i = 0; i < METACACHE_SIZE; i++) {
+		if (!cache[i].metadata.path || strcmp(cache[i].metadata.path, path)) continue;
+		if ((s32_t) (now - cache[i].expires) >= 0) {
+			sq_free_metadata(&cache[i].metadata);
+			break;
+		}
+		cache[i].last = now;
+		sq_copy_metadata(metadata, &cache[i].metadata);
+		cache_hits++;
+		mutex_unlock(cache_mutex);
+		return true;
+	}
+
+	cache_misses++;
+	mutex_unlock(cache_mutex);
+
+	return false;
+}
+
+/*---------------------------------------------------------------------------*/
+void metacache_put(sq_metadata_t *metadata) {
+	u32_t now = gettime_ms();
+	int i, slot = 0;
+
+	if (!metadata->path || !strncmp(metadata->path, "http", 4)) return;
+
+	mutex_lock(cache_mutex);
+
+	// replace same path, else take a free slot, else evict LRU
+	for (i = 0; i < METACACHE_SIZE; i++) {
+		if (cache[i].metadata.path && !strcmp(cache[i].metadata.path, metadata->path)) {
+			slot = i;
+			break;
+		}
+		if (!cache[i].metadata.path) {
+			if (cache[slot].metadata.path) slot = i;
+		} else if (cache[slot].metadata.path && (s32_t) (cache[i].last - cache[slot].last) < 0) slot = i;
+	}
+
+	sq_free_metadata(&cache[slot].metadata);
+	sq_copy_metadata(&cache[slot].metadata, metadata);
+	cache[slot].last = now;
+	cache[slot].expires = now + METACACHE_TTL;
+
+	mutex_unlock(cache_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void sq_metadata_stats(u32_t *hits, u32_t *misses, u32_t *entries) {
+	int i;
+
+	mutex_lock(cache_mutex);
+	*hits = cache_hits;
+	*misses = cache_misses;
+	for (*entries = i = 0; i < METACACHE_SIZE; i++) if (cache[i].metadata.path) (*entries)++;
+	mutex_unlock(cache_mutex);
+}
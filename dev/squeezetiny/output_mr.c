@@ -496,8 +496,7 @@ static void output_thru_thread(struct thread_ctx_s *ctx) {
 			fclose(out->write_file);
 			out->write_file = NULL;
 #ifdef __EARLY_STMd__
-			ctx->read_ended = true;
-			wake_controller(ctx);
+			player_event(ctx, EV_READ_ENDED);
 #endif
 
 			UNLOCK_S;
@@ -18,16 +18,16 @@
  *
  */
 
-/* TODO
-- maybe one single CLI socket for all machines
-*/
-
 #include "squeezelite.h"
 #include "slimproto.h"
 
 #define PORT 3483
 #define MAXBUF 4096
 
+#define RECONNECT_MIN		50		// ms, doubled at each failure
+#define RECONNECT_MAX		5000
+#define FAILOVER_COUNT		3		// failures before trying next server of the list
+
 unsigned gl_slimproto_stream_port = 9000;
 
 #if SL_LITTLE_ENDIAN
@@ -92,6 +92,280 @@ bool ctx_callback(struct thread_ctx_s *ctx, sq_action_t action, u8_t *cookie, vo
 }
 
 
+/*---------------------------------------------------------------------------*/
+static char *event_name[] = { "none", "stream", "read ended", "read timeout", "playing",
+							  "stopped", "track change", "timer", "LMS", "resume" };
+static char *state_name[] = { "STOPPED", "STARTING", "PLAYING", "PAUSED" };
+
+/*---------------------------------------------------------------------------*/
+static void trace_event(struct thread_ctx_s *ctx, player_event_t event, player_state_t from) {
+	struct trace_record *t = ctx->trace + (ctx->trace_idx++ & (TRACE_SIZE - 1));
+
+	t->time = gettime_ms();
+	t->event = event;
+	t->from = from;
+	t->to = ctx->state;
+	LOG_DEBUG("[%p] %s: %s -> %s", ctx, event_name[event], state_name[from], state_name[t->to]);
+}
+
+/*---------------------------------------------------------------------------*/
+static void dump_trace(struct thread_ctx_s *ctx) {
+	unsigned i;
+
+	for (i = 0; i < TRACE_SIZE; i++) {
+		struct trace_record *t = ctx->trace + ((ctx->trace_idx + i) & (TRACE_SIZE - 1));
+		if (t->event == EV_NONE) continue;
+		LOG_INFO("[%p] trace %u %s: %s -> %s", ctx, t->time, event_name[t->event],
+				 state_name[t->from], state_name[t->to]);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// can be called from any thread, queue is lock-free (bounded MPSC)
+void player_event(struct thread_ctx_s *ctx, player_event_t event) {
+	struct event_queue *q = &ctx->events;
+	u32_t pos = q->head;
+	s32_t dif;
+
+	while (1) {
+		dif = q->slot[pos & (EVENT_QUEUE_SIZE - 1)].seq - pos;
+		if (!dif) {
+			if (__sync_bool_compare_and_swap(&q->head, pos, pos + 1)) break;
+		} else if (dif < 0) {
+			// never lose an event, coalesce it and only keep the latest state
+			__sync_lock_test_and_set(&q->overflow_time[event], gettime_ms());
+			if (event == EV_PLAYING || event == EV_STOPPED) __sync_lock_test_and_set(&q->overflow_state, event);
+			__sync_fetch_and_or(&q->overflow, 1 << event);
+			LOG_WARN("[%p] event queue full, %s coalesced", ctx, event_name[event]);
+			wake_controller(ctx);
+			return;
+		}
+		pos = q->head;
+	}
+
+	q->slot[pos & (EVENT_QUEUE_SIZE - 1)].event = event;
+	q->slot[pos & (EVENT_QUEUE_SIZE - 1)].time = gettime_ms();
+	__sync_synchronize();
+	q->slot[pos & (EVENT_QUEUE_SIZE - 1)].seq = pos + 1;
+
+	wake_controller(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+static bool pop_event(struct thread_ctx_s *ctx, player_event_t *event, u32_t *time) {
+	struct event_queue *q = &ctx->events;
+	u32_t idx = q->tail & (EVENT_QUEUE_SIZE - 1);
+
+	if ((s32_t) (q->slot[idx].seq - (q->tail + 1)) < 0) return false;
+
+	__sync_synchronize();
+	*event = q->slot[idx].event;
+	*time = q->slot[idx].time;
+	__sync_synchronize();
+	q->slot[idx].seq = q->tail + EVENT_QUEUE_SIZE;
+	q->tail++;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t calibrate(u32_t value, u32_t sample) {
+	// smooth measures as polling adds jitter, first one is taken as is
+	return value ? (value * 3 + sample) / 4 : sample;
+}
+
+/*---------------------------------------------------------------------------*/
+static void process_event(struct thread_ctx_s *ctx, player_event_t event, u32_t time) {
+	player_state_t from = ctx->state;
+	bool calibrated = false, resume = false;
+
+	LOCK_S;
+
+	switch (event) {
+	case EV_PLAYING:
+		/*
+		Be careful of what is done here in case the "playing" event if
+		an extra one generated by an unwanted stop or a lack of NextURI cap
+		*/
+		if (ctx->state == PLAYER_STARTING) ctx->state = PLAYER_PLAYING;
+		if (ctx->play_request) {
+			u32_t latency = time - ctx->play_request;
+
+			ctx->config.play_latency = calibrate(ctx->config.play_latency, latency);
+			ctx->play_request = 0;
+			calibrated = true;
+			LOG_INFO("[%p] play latency %u (calibrated %u)", ctx, latency, ctx->config.play_latency);
+		}
+		break;
+	case EV_STOPPED:
+		// a stop when starting is the late one of what was playing before
+		if (ctx->state == PLAYER_PLAYING || ctx->state == PLAYER_PAUSED) {
+			ctx->state = PLAYER_STOPPED;
+			ctx->track_ended = true;
+			// natural end of track, measure how far ahead renderer was reading
+			if (ctx->read_end_time) {
+				u32_t delay = time - ctx->read_end_time;
+
+				ctx->config.output_delay = calibrate(ctx->config.output_delay, delay);
+				calibrated = true;
+				LOG_INFO("[%p] output delay %u (calibrated %u)", ctx, delay, ctx->config.output_delay);
+			}
+		}
+		ctx->read_end_time = 0;
+		break;
+	case EV_TRACK_CHANGE:
+		if (ctx->state != PLAYER_PLAYING) break;
+		LOG_INFO("[%p] End of track by track change", ctx);
+		ctx->ms_played = 0;
+		ctx->track_start_time = time;
+		/*
+		change is detected by polling, so estimate when the new track
+		really started from when previous one was fully read
+		*/
+		if (ctx->read_end_time && ctx->config.output_delay &&
+			time > ctx->read_end_time + ctx->config.output_delay) {
+			ctx->track_start_time = ctx->read_end_time + ctx->config.output_delay;
+			ctx->ms_played = time - ctx->track_start_time;
+		}
+		ctx->read_end_time = 0;
+		ctx->track_new = true;
+		break;
+	case EV_READ_ENDED:
+		ctx->read_ended = true;
+		ctx->read_end_time = time;
+		break;
+	case EV_READ_TIMEOUT:
+		ctx->read_to = true;
+		break;
+	case EV_RESUME:
+		resume = true;
+		break;
+	default:
+		break;
+	}
+
+	UNLOCK_S;
+
+	trace_event(ctx, event, from);
+
+	// let the controller store new calibration with the device config
+	if (calibrated) ctx_callback(ctx, SQ_CALIBRATE, NULL, &ctx->config);
+
+	// LMS has acknowledged the seek on resume, controller can now play
+	if (resume) ctx_callback(ctx, SQ_PLAY, NULL, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t take_overflow(struct thread_ctx_s *ctx, u32_t pending, u32_t *times) {
+	struct event_queue *q = &ctx->events;
+	u32_t mask, both = (1 << EV_PLAYING) | (1 << EV_STOPPED);
+	player_event_t event;
+
+	if (!q->overflow) return pending;
+
+	// times and state are stored before the bit is set
+	mask = __sync_fetch_and_and(&q->overflow, 0);
+	if (mask & both) {
+		event = __sync_fetch_and_or(&q->overflow_state, 0);
+		pending &= ~both;
+		mask &= ~(both & ~(1 << event));
+	}
+
+	for (event = EV_STREAM; event < EV_MAX; event++) {
+		if (mask & (1 << event)) times[event] = __sync_fetch_and_or(&q->overflow_time[event], 0);
+	}
+
+	return pending | mask;
+}
+
+/*---------------------------------------------------------------------------*/
+static u32_t process_overflow(struct thread_ctx_s *ctx, u32_t pending, u32_t *times, u32_t *until) {
+	player_event_t event, oldest;
+
+	// in the order they happened, up to the queued event about to be processed
+	while (pending) {
+		for (oldest = EV_NONE, event = EV_STREAM; event < EV_MAX; event++) {
+			if (!(pending & (1 << event))) continue;
+			if (oldest == EV_NONE || (s32_t) (times[event] - times[oldest]) < 0) oldest = event;
+		}
+		if (until && (s32_t) (times[oldest] - *until) > 0) break;
+		pending &= ~(1 << oldest);
+		process_event(ctx, oldest, times[oldest]);
+	}
+
+	return pending;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool process_events(struct thread_ctx_s *ctx) {
+	player_event_t event;
+	u32_t time, pending = 0, times[EV_MAX];
+	bool processed = false;
+
+	/*
+	Events that overflowed did not fit in a full queue, so they are newer
+	than what was queued then but older than what was queued afterwards
+	*/
+	while (1) {
+		pending = take_overflow(ctx, pending, times);
+		if (!pop_event(ctx, &event, &time)) break;
+		pending = process_overflow(ctx, pending, times, &time);
+		process_event(ctx, event, time);
+		processed = true;
+	}
+
+	if (pending) {
+		process_overflow(ctx, pending, times, NULL);
+		processed = true;
+	}
+
+	return processed;
+}
+
+/*---------------------------------------------------------------------------*/
+static void set_start_at(struct thread_ctx_s *ctx, u32_t start_at) {
+	ctx->start_at = start_at;
+	ctx->deadline_at = 0;
+
+	if (start_at) {
+		s32_t delay = start_at - gettime_ms();
+		ctx->deadline_at = gettime_us() + (delay > 0 ? delay : 0) * 1000LL;
+	}
+
+#if DEADLINE_TIMER
+	{
+		struct itimerspec ts;
+
+		// an all-zero value disarms the timer
+		memset(&ts, 0, sizeof(ts));
+		ts.it_value.tv_sec = ctx->deadline_at / 1000000;
+		ts.it_value.tv_nsec = (ctx->deadline_at % 1000000) * 1000;
+		timerfd_settime(ctx->deadline, TFD_TIMER_ABSTIME, &ts, NULL);
+	}
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+static void check_start_at(struct thread_ctx_s *ctx) {
+	u32_t now = gettime_ms();
+	player_state_t from = ctx->state;
+
+	if (!ctx->start_at || (s32_t) (now - ctx->start_at) < 0) return;
+
+	LOG_INFO("[%p] start time elapsed %u %u (late by %d us)", ctx, ctx->start_at, now,
+			 (int) (gettime_us() - ctx->deadline_at));
+	set_start_at(ctx, 0);
+	// a paused renderer has already confirmed it was running
+	if (ctx->state == PLAYER_PAUSED) ctx->state = PLAYER_PLAYING;
+	else {
+		ctx->track_new = true;
+		if (ctx->state == PLAYER_STOPPED) ctx->state = PLAYER_STARTING;
+	}
+	ctx->play_request = now;
+	ctx_callback(ctx, SQ_PLAY, NULL, NULL);
+	trace_event(ctx, EV_TIMER, from);
+}
+
 /*---------------------------------------------------------------------------*/
 void send_packet(u8_t *packet, size_t len, sockfd sock) {
 	u8_t *ptr = packet;
@@ -234,6 +508,11 @@ static void sendSETDName(const char *name, sockfd sock) {
 /*---------------------------------------------------------------------------*/
 static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 	struct strm_packet *strm = (struct strm_packet *)pkt;
+	player_state_t from;
+
+	// pending events belong to what was playing before that command
+	process_events(ctx);
+	from = ctx->state;
 
 	if (strm->command != 't' && strm->command != 'q') {
 		LOG_INFO("[%p] strm command %c", ctx, strm->command);
@@ -250,9 +529,12 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 	case 'q':
 		decode_flush(ctx);
 		output_flush(ctx);
-		ctx->play_running = ctx-> track_ended = false;
-		ctx->track_status = TRACK_STOPPED;
+		ctx->track_ended = false;
+		ctx->state = PLAYER_STOPPED;
 		ctx->status.ms_played = ctx->ms_played = 0;
+		ctx->play_request = ctx->read_end_time = 0;
+		set_start_at(ctx, 0);
+		playlist_invalidate(ctx);
 		if (stream_disconnect(ctx))
 			if (strm->command == 'f') sendSTAT("STMf", 0, ctx);
 		buf_flush(ctx->streambuf);
@@ -263,8 +545,9 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			unsigned interval = unpackN(&strm->replay_gain);
 
 			ctx->ms_pause = interval;
-			ctx->start_at = (interval) ? gettime_ms() + interval : 0;
-			ctx->track_status = TRACK_PAUSED;
+			// renderer takes play_latency to resume, so ask it that much earlier
+			set_start_at(ctx, (interval) ? gettime_ms() + interval - min(interval, ctx->config.play_latency) : 0);
+			ctx->state = PLAYER_PAUSED;
 			ctx_callback(ctx, SQ_PAUSE, NULL, NULL);
 			if (!interval) {
 				sendSTAT("STMp", 0, ctx);
@@ -284,15 +567,25 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			unsigned jiffies = unpackN(&strm->replay_gain);
 
 			LOG_INFO("[%p] unpause at: %u now: %u", ctx, jiffies, gettime_ms());
-			ctx->start_at = jiffies;
+			set_start_at(ctx, (jiffies > ctx->config.play_latency) ? jiffies - ctx->config.play_latency : jiffies);
 			if (!jiffies) {
 				// this is an unpause after for an autostart = 0 or 2
-				if (ctx->track_status == TRACK_STOPPED) {
+				switch (ctx->state) {
+				case PLAYER_STOPPED:
 					ctx->track_new = true;
-					ctx->track_start_time = gettime_ms();
+					ctx->track_start_time = gettime_ms() + ctx->config.play_latency;
+					ctx->state = PLAYER_STARTING;
+					ctx->play_request = gettime_ms();
+					ctx_callback(ctx, SQ_UNPAUSE, NULL, NULL);
+					break;
+				case PLAYER_PAUSED:
+					ctx->state = PLAYER_PLAYING;
+					ctx->play_request = gettime_ms();
+					ctx_callback(ctx, SQ_UNPAUSE, NULL, NULL);
+					break;
+				default:
+					break;
 				}
-				if (ctx->track_status != TRACK_STARTED) ctx_callback(ctx, SQ_UNPAUSE, NULL, NULL);
-				ctx->track_status = TRACK_STARTED;
 			}
 			sendSTAT("STMr", 0, ctx);
 		}
@@ -387,13 +680,12 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 #ifdef TEST_IDX_BUF
 						strcpy(uri.urn, "__song__.mp3");
 #endif
-						if (ctx->play_running || ctx->track_status != TRACK_STOPPED) {
+						if (ctx->state != PLAYER_STOPPED) {
 							ctx_callback(ctx, SQ_SETNEXTURI, NULL, &uri);
 						}
 						else {
 							ctx_callback(ctx, SQ_SETURI, NULL, &uri);
 							ctx->track_ended = false;
-							ctx->track_status = TRACK_STOPPED;
 							ctx->track_new = true;
 							ctx->status.ms_played = ctx->ms_played = 0;
 							ctx->read_to = ctx->read_ended = false;
@@ -425,6 +717,8 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 		LOG_WARN("[%p] unhandled strm %c", ctx, strm->command);
 		break;
 	}
+
+	if (ctx->state != from) trace_event(ctx, EV_LMS, from);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -464,9 +758,10 @@ static void process_aude(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 	LOG_DEBUG("[%p] on/off using aude %d", ctx, ctx->on);
 	decode_flush(ctx);
 	output_flush(ctx);
-	ctx->play_running = ctx-> track_ended = false;
-	ctx->track_status = TRACK_STOPPED;
+	ctx->track_ended = false;
+	ctx->state = PLAYER_STOPPED;
 	ctx->status.ms_played = ctx->ms_played = 0;
+	ctx->play_request = ctx->read_end_time = 0;
 	stream_disconnect(ctx);
 	buf_flush(ctx->streambuf);
 	UNLOCK_O;
@@ -582,17 +877,29 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 	int  expect = 0;
 	int  got    = 0;
 	u32_t now;
-	event_handle ehandles[2];
+	event_handle ehandles[2 + DEADLINE_TIMER];
 	int timeouts = 0;
 
 	set_readwake_handles(ehandles, ctx->sock, ctx->wake_e);
+#if DEADLINE_TIMER
+	set_deadline_handle(ehandles, ctx->deadline);
+#endif
 
-	while (ctx->running && !ctx->new_server) {
+	while (ctx->running && !ctx->new_server && !ctx->caps_changed) {
 
 		bool wake = false;
 		event_type ev;
+		int timeout = 1000;
 
-		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
+#if !DEADLINE_TIMER
+		// no timer, so don't sleep past a timed start
+		if (ctx->start_at) {
+			s32_t delay = ctx->start_at - gettime_ms();
+			timeout = min(max(delay, 0), timeout);
+		}
+#endif
+
+		if ((ev = wait_readwake(ehandles, timeout)) != EVENT_TIMEOUT) {
 
 			if (ev == EVENT_READ) {
 
@@ -640,6 +947,10 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 				wake = true;
 			}
 
+			if (ev == EVENT_TIMER) {
+				wake = true;
+			}
+
 			timeouts = 0;
 
 		} else if (++timeouts > 35) {
@@ -649,6 +960,12 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			return;
 		}
 
+		// state changes from other threads are applied, then STAT sent right away
+		if (process_events(ctx)) wake = true;
+
+		// timed start normally fires from the deadline, this is a safety net
+		check_start_at(ctx);
+
 		// update playback state when woken or every 100ms
 		now = gettime_ms();
 
@@ -696,14 +1013,6 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			}
 			UNLOCK_S;
 
-			if (ctx->start_at && now > ctx->start_at) {
-				LOG_INFO("[%p] start time elapsed %d %d", ctx, ctx->start_at, now);
-				ctx->start_at = 0;
-				if (ctx->track_status != TRACK_PAUSED) ctx->track_new = true;
-				ctx->track_status = TRACK_STARTED;
-				ctx_callback(ctx, SQ_PLAY, NULL, NULL);
-			}
-
 			// end of streaming
 			if (!ctx->sentSTMu && ctx->status.stream_state <= DISCONNECT && ctx->track_ended) {
 				_sendSTMu = true;
@@ -712,6 +1021,7 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 				if (!ctx->sentSTMd) {
 					_sendSTMn = true;
 					LOG_WARN("[%p]: unwanted stop, reporting error", ctx);
+					dump_trace(ctx);
 				}
 				ctx->track_ended = false;
 			}
@@ -729,18 +1039,20 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 					_sendSTMl = true;
 					ctx->sentSTMl = true;
 				 }
-				 else if (ctx->track_status == TRACK_STOPPED) {
+				 else if (ctx->state == PLAYER_STOPPED) {
+					 ctx->play_request = now;
 					 ctx_callback(ctx, SQ_PLAY, NULL, NULL);
 					 LOCK_S;
-					 ctx->track_status = TRACK_STARTED;
+					 ctx->state = PLAYER_STARTING;
 					 ctx->track_new = true;
-					 ctx->track_start_time = now;
+					 // audio is expected once renderer has processed the Play
+					 ctx->track_start_time = now + ctx->config.play_latency;
 					 UNLOCK_S;
 				 }
 			}
 
 			// few thing need to wait for the running to be confirmed by player
-			if (ctx->play_running) {
+			if (ctx->state == PLAYER_PLAYING || ctx->state == PLAYER_PAUSED) {
 				// either 1st track or end of track detected by the player
 				if (ctx->track_new) {
 					_sendSTMs = true;
@@ -833,14 +1145,42 @@ in_addr_t discover_server(struct thread_ctx_s *ctx) {
 	return s.sin_addr.s_addr;
 }
 
+/*---------------------------------------------------------------------------*/
+static unsigned server_count(struct thread_ctx_s *ctx) {
+	unsigned count = *ctx->server ? 1 : 0;
+	char *p;
+
+	for (p = ctx->server; *p; p++) if (*p == ',') count++;
+	return count;
+}
+
+/*---------------------------------------------------------------------------*/
+// server is a list <server>[:<port>][,<server>[:<port>]]..., pick one (wrapping)
+static bool select_server(unsigned idx, in_addr_t *ip, unsigned *port, struct thread_ctx_s *ctx) {
+	char item[SERVER_NAME_LEN + 1], *p = ctx->server;
+
+	if (!*ctx->server) return false;
+
+	for (idx %= server_count(ctx); idx; idx--) p = strchr(p, ',') + 1;
+
+	strncpy(item, p, SERVER_NAME_LEN);
+	item[SERVER_NAME_LEN] = '\0';
+	if ((p = strchr(item, ',')) != NULL) *p = '\0';
+
+	*ip = 0;
+	*port = PORT;
+	server_addr(item, ip, port);
+
+	return *ip != 0;
+}
+
 /*---------------------------------------------------------------------------*/
 static void slimproto(struct thread_ctx_s *ctx) {
 	bool reconnect = false;
-	unsigned failed_connect = 0;
-	struct sockaddr_in cli_addr;
+	unsigned failed_connect = 0, server_idx = 0;
+	u32_t backoff = RECONNECT_MIN;
 
 	mutex_create(ctx->mutex);
-	mutex_create(ctx->cli_mutex);
 
 	while (ctx->running) {
 
@@ -858,23 +1198,38 @@ static void slimproto(struct thread_ctx_s *ctx) {
 
 		if (connect_timeout(ctx->sock, (struct sockaddr *) &ctx->serv_addr, sizeof(ctx->serv_addr), 5) != 0) {
 
-			LOG_WARN("[%p] unable to connect to server %u", ctx, failed_connect);
-			sleep(5);
-
-			// rediscover server if it was not set at startup
-			if (!ctx->server && ++failed_connect > 5) {
+			LOG_WARN("[%p] unable to connect to server %u (retry in %u ms)", ctx, failed_connect, backoff);
+			usleep(backoff * 1000);
+			backoff = min(backoff * 2, RECONNECT_MAX);
+			failed_connect++;
+
+			if (server_count(ctx) > 1 && failed_connect >= FAILOVER_COUNT) {
+				// try next server of the list, this is a new session for it
+				if (select_server(++server_idx, &ctx->slimproto_ip, &ctx->slimproto_port, ctx)) {
+					ctx->serv_addr.sin_addr.s_addr = ctx->slimproto_ip;
+					ctx->serv_addr.sin_port = htons(ctx->slimproto_port);
+					LOG_INFO("[%p] failover to %s:%d", ctx, inet_ntoa(ctx->serv_addr.sin_addr), ntohs(ctx->serv_addr.sin_port));
+				}
+				failed_connect = 0;
+				reconnect = false;
+			} else if (!*ctx->server && failed_connect > 5) {
+				// rediscover server if it was not set at startup
 				ctx->slimproto_ip = ctx->serv_addr.sin_addr.s_addr = discover_server(ctx);
+				failed_connect = 0;
 			}
 
 		} else {
 
 			struct sockaddr_in our_addr;
 			socklen_t len;
+			char fixed_cap[sizeof(ctx->fixed_cap)];
 
 			LOG_INFO("[%p] connected", ctx);
 
 			ctx->var_cap[0] = '\0';
+			ctx->caps_changed = false;
 			failed_connect = 0;
+			backoff = RECONNECT_MIN;
 
 			// check if this is a local player now we are connected & signal to server via 'loc' format
 			// this requires LocalPlayer server plugin to enable direct file access
@@ -895,46 +1250,41 @@ static void slimproto(struct thread_ctx_s *ctx) {
 				ctx->new_server_cap = NULL;
 			}
 
-			sendHELO(reconnect, ctx->fixed_cap, ctx->var_cap, ctx->mac, ctx);
-
-			/*
-			there could be a global CLIn socket for all the devices, but this
-			would require a mutex to handle it to make sure command / response
-			are sent in the right sequence ... at that time, let's use a CLI
-			socket per machine
-			*/
-			// open CLI socket
-			ctx->cli_sock = socket(AF_INET, SOCK_STREAM, 0);
-			set_nonblock(ctx->cli_sock);
-			set_nosigpipe(ctx->cli_sock);
+			LOCK_O;
+			strcpy(fixed_cap, ctx->fixed_cap);
+			UNLOCK_O;
+			sendHELO(reconnect, fixed_cap, ctx->var_cap, ctx->mac, ctx);
 
-			cli_addr.sin_family = AF_INET;
-			cli_addr.sin_addr.s_addr = ctx->slimproto_ip;
-			cli_addr.sin_port = htons(9090);
-
-			if (connect_timeout(ctx->cli_sock, (struct sockaddr *) &cli_addr, sizeof(cli_addr), 1) != 0) {
-				LOG_ERROR("[%p] unable to connect to server with cli %u", ctx, failed_connect);
-			}
+			// attach to the CLI connection of that server (kept across reconnects)
+			cli_open(ctx);
+			playlist_notify(ctx);
 
 			slimproto_run(ctx);
 
+			/*
+			HELO will be sent with reconnect bit and bytes received so that
+			LMS resumes the session and the renderer keeps playing its buffer
+			*/
 			if (!reconnect) {
 				reconnect = true;
 			}
 
-			usleep(100000);
+			usleep(RECONNECT_MIN * 1000);
 		}
 
 		closesocket(ctx->sock);
-		closesocket(ctx->cli_sock);
 		if (ctx->new_server_cap)	{
 			free(ctx->new_server_cap);
 			ctx->new_server_cap = NULL;
 		}
 	}
 
+	cli_close(ctx);
+	playlist_invalidate(ctx);
 	mutex_destroy(ctx->mutex);
-	mutex_destroy(ctx->cli_mutex);
+#if DEADLINE_TIMER
+	deadline_close(ctx->deadline);
+#endif
 }
 
 
@@ -958,8 +1308,8 @@ static void slimproto_short(struct thread_ctx_s *ctx) {
 
 	while (ctx->running) {
 
-		if (ctx->server) {
-			server_addr(ctx->server, &ip, &port);
+		if (*ctx->server) {
+			select_server(0, &ip, &port, ctx);
 			if (!ip) {
 				ip = discover_server(ctx);
 				port = PORT;
@@ -1003,19 +1353,84 @@ void slimproto_loglevel(log_level level) {
 	loglevel = level;
 }
 
+/*---------------------------------------------------------------------------*/
+// must be called with LOCK_O held
+static void _set_fixed_cap(struct thread_ctx_s *ctx) {
+	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", ctx->config.sample_rate);
+
+	/* codecs are amongst the few system-wide items */
+	if (ctx->config.mode != SQ_FULL) {
+		strcat(ctx->fixed_cap, ",");
+		strcat(ctx->fixed_cap, ctx->config.codecs);
+    }
+	else
+	{
+#if 0
+		for (i = 0; i < MAX_CODECS; i++) {
+			if (codecs[i] && codecs[i]->id && strlen(ctx->fixed_cap) < 128 - 10) {
+				strcat(ctx->fixed_cap, ",");
+				strcat(ctx->fixed_cap, codecs[i]->types);
+			}
+		}
+#endif
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void set_fixed_cap(struct thread_ctx_s *ctx) {
+	LOCK_O;
+	_set_fixed_cap(ctx);
+	UNLOCK_O;
+}
+
+/*---------------------------------------------------------------------------*/
+void slimproto_set_codecs(struct thread_ctx_s *ctx, char *codecs) {
+	char fixed_cap[sizeof(ctx->fixed_cap)];
+	bool changed;
+
+	// slimproto thread reads these when sending HELO
+	LOCK_O;
+	if (strcmp(ctx->config.codecs, codecs)) LOG_INFO("[%p] codecs changed from %s to %s", ctx, ctx->config.codecs, codecs);
+	strcpy(fixed_cap, ctx->fixed_cap);
+	strncpy(ctx->config.codecs, codecs, SQ_STR_LENGTH - 1);
+	_set_fixed_cap(ctx);
+	changed = strcmp(fixed_cap, ctx->fixed_cap) != 0;
+	UNLOCK_O;
+
+	// capabilities are only sent in HELO, so reconnect (session is resumed)
+	if (!changed) return;
+	ctx->caps_changed = true;
+	wake_controller(ctx);
+}
+
 /*---------------------------------------------------------------------------*/
 void slimproto_thread_init(char *server, u8_t mac[6], const char *name, const char *namefile, struct thread_ctx_s *ctx) {
+	unsigned i;
+
 	wake_create(ctx->wake_e);
+#if DEADLINE_TIMER
+	deadline_create(ctx->deadline);
+#endif
+
+	for (i = 0; i < EVENT_QUEUE_SIZE; i++) ctx->events.slot[i].seq = i;
+	ctx->events.head = ctx->events.tail = 0;
+	ctx->events.overflow = 0;
+	memset(ctx->trace, 0, sizeof(ctx->trace));
+	ctx->trace_idx = 0;
 
 	ctx->running = true;
 	ctx->slimproto_ip = 0;
 	ctx->slimproto_port = 0;
 	ctx->sock = -1;
+	ctx->cli = NULL;
+	memset(&ctx->playlist, 0, sizeof(ctx->playlist));
 
 	if (server) {
-		server_addr(server, &ctx->slimproto_ip, &ctx->slimproto_port);
 		strncpy(ctx->server, server, SERVER_NAME_LEN);
+		ctx->server[SERVER_NAME_LEN] = '\0';
+		select_server(0, &ctx->slimproto_ip, &ctx->slimproto_port, ctx);
 	}
+	else *ctx->server = '\0';
 
 	if (!ctx->slimproto_ip) {
 		ctx->slimproto_ip = discover_server(ctx);
@@ -1033,27 +1448,9 @@ void slimproto_thread_init(char *server, u8_t mac[6], const char *name, const ch
 	/* could be avoided as whole context is reset at init ...*/
 	strcpy(ctx->var_cap, "");
 	ctx->new_server_cap = NULL;
+	ctx->caps_changed = false;
 
-	LOCK_O;
-	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", ctx->config.sample_rate);
-
-	/* codecs are amongst the few system-wide items */
-	if (ctx->config.mode != SQ_FULL) {
-		strcat(ctx->fixed_cap, ",");
-		strcat(ctx->fixed_cap, ctx->config.codecs);
-    }
-	else
-	{
-#if 0
-		for (i = 0; i < MAX_CODECS; i++) {
-			if (codecs[i] && codecs[i]->id && strlen(ctx->fixed_cap) < 128 - 10) {
-				strcat(ctx->fixed_cap, ",");
-				strcat(ctx->fixed_cap, codecs[i]->types);
-			}
-		}
-#endif
-	}
-	UNLOCK_O;
+	set_fixed_cap(ctx);
 
 	ctx->serv_addr.sin_family = AF_INET;
 	ctx->serv_addr.sin_addr.s_addr = ctx->slimproto_ip;
@@ -1064,8 +1461,8 @@ void slimproto_thread_init(char *server, u8_t mac[6], const char *name, const ch
 	LOG_INFO("[%p] connecting to %s:%d", ctx, inet_ntoa(ctx->serv_addr.sin_addr), ntohs(ctx->serv_addr.sin_port));
 
 	ctx->new_server = 0;
-	ctx->play_running = ctx-> track_ended = false;
-	ctx->track_status = TRACK_STOPPED;
+	ctx->track_ended = false;
+	ctx->state = PLAYER_STOPPED;
 
 #if LINUX || OSX || FREEBSD
 	pthread_attr_t attr;
@@ -7,7 +7,7 @@
 #define SQ_STR_LENGTH	256
 
 typedef enum {SQ_NONE, SQ_SETFORMAT, SQ_SETURI, SQ_SETNEXTURI, SQ_PLAY, SQ_PAUSE, SQ_UNPAUSE, SQ_STOP, SQ_SEEK,
-			  SQ_VOLUME, SQ_TIME, SQ_TRACK_CHANGE, SQ_ONOFF} sq_action_t;
+			  SQ_VOLUME, SQ_TIME, SQ_TRACK_CHANGE, SQ_ONOFF, SQ_CALIBRATE} sq_action_t;
 typedef enum {SQ_LMSUPNP = 0, SQ_STREAM = 2, SQ_FULL = 3} sq_mode_t;
 typedef	sq_action_t sq_event_t;
 
@@ -53,6 +53,8 @@ typedef	struct sq_dev_param_s {
 	s32_t		buffer_limit;
 	int			seek_after_pause;
 	u8_t		mac[6];
+	u32_t		play_latency;		// ms from Play request to PLAYING (calibrated)
+	u32_t		output_delay;		// ms from last byte read to end of track (calibrated)
 } sq_dev_param_t;
 
 typedef struct sq_log_level_s {		// must be one of lERROR, lINFO, lDEBUG or lSDEBUG
@@ -102,7 +104,10 @@ u32_t 				sq_get_time(sq_dev_handle_t handle);
 bool				sq_get_metadata(sq_dev_handle_t handle, struct sq_metadata_s *metadata, bool next);
 void				sq_default_metadata(struct sq_metadata_s *metadata, bool init);
 void 				sq_free_metadata(struct sq_metadata_s *metadata);
+void				sq_metadata_stats(u32_t *hits, u32_t *misses, u32_t *entries);
 bool 				sq_set_time(sq_dev_handle_t handle, u32_t time);
+bool				sq_seek_resume(sq_dev_handle_t handle);
+void				sq_set_codecs(sq_dev_handle_t handle, char *codecs);
 void*				sq_urn2MR(const char *urn);
 void*				sq_get_info(const char *urn, s32_t *filesize, char **content_type);	// string must be released by caller
 void*				sq_open(const char *urn);
@@ -194,6 +194,16 @@ struct wake {
 #define wake_close(e) CloseHandle(e)
 #endif
 
+// deadline timer for timed start, otherwise poll timeout is used
+#if EVENTFD
+#include <sys/timerfd.h>
+#define DEADLINE_TIMER 1
+#define deadline_create(t) t = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)
+#define deadline_close(t) close(t)
+#else
+#define DEADLINE_TIMER 0
+#endif
+
 // printf/scanf formats for u64_t
 #if (LINUX && __WORDSIZE == 64) || (FREEBSD && __LP64__)
 #define FMT_u64 "%lu"
@@ -215,16 +225,20 @@ struct wake {
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 
 // utils.c (non logging)
-typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE } event_type;
+typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE, EVENT_TIMER } event_type;
 struct thread_ctx_s;
 
 char *next_param(char *src, char c);
 u32_t gettime_ms(void);
+u64_t gettime_us(void);
 void get_mac(u8_t *mac);
 void set_nonblock(sockfd s);
 int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout);
 void server_addr(char *server, in_addr_t *ip_ptr, unsigned *port_ptr);
 void set_readwake_handles(event_handle handles[], sockfd s, event_event e);
+#if DEADLINE_TIMER
+void set_deadline_handle(event_handle handles[], int t);
+#endif
 event_type wait_readwake(event_handle handles[], int timeout);
 void packN(u32_t *dest, u32_t val);
 void packn(u16_t *dest, u16_t val);
@@ -276,13 +290,68 @@ void buf_init(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
 
 // slimproto.c
+typedef enum { EV_NONE = 0, EV_STREAM, EV_READ_ENDED, EV_READ_TIMEOUT, EV_PLAYING, EV_STOPPED,
+			   EV_TRACK_CHANGE, EV_TIMER, EV_LMS, EV_RESUME, EV_MAX } player_event_t;
+typedef enum { PLAYER_STOPPED = 0, PLAYER_STARTING, PLAYER_PLAYING, PLAYER_PAUSED } player_state_t;
+
+#define EVENT_QUEUE_SIZE	32		// must be a power of 2
+#define TRACE_SIZE			16
+
+struct event_queue {
+	struct {
+		volatile u32_t	seq;
+		player_event_t	event;
+		u32_t			time;
+	} slot[EVENT_QUEUE_SIZE];
+	volatile u32_t	head;			// producers (any thread)
+	u32_t			tail;			// consumer (slimproto thread)
+	volatile u32_t	overflow;		// events that did not fit, one bit per event
+	volatile u32_t	overflow_time[EV_MAX];	// when each of them last happened
+	volatile player_event_t overflow_state;	// latest of EV_PLAYING/EV_STOPPED that did not fit
+};
+
+struct trace_record {
+	u32_t			time;
+	player_event_t	event;
+	player_state_t	from, to;
+};
+
 void slimproto_close(struct thread_ctx_s *ctx);
 void slimproto_init(log_level level, bool full);
 void slimproto_reset(struct thread_ctx_s *ctx);
 void slimproto_thread_init(char *server, u8_t mac[], const char *name, const char *namefile, struct thread_ctx_s *ctx);
+void slimproto_set_codecs(struct thread_ctx_s *ctx, char *codecs);
 void wake_controller(struct thread_ctx_s *ctx);
 void send_packet(u8_t *packet, size_t len, sockfd sock);
 void wake_controller(struct thread_ctx_s *ctx);
+bool ctx_callback(struct thread_ctx_s *ctx, sq_action_t action, u8_t *cookie, void *param);
+void player_event(struct thread_ctx_s *ctx, player_event_t event);
+
+// cli.c
+struct cli_s;
+typedef void (*cli_callback_t)(void *arg, char *rsp);
+
+void cli_loglevel(log_level level);
+void cli_open(struct thread_ctx_s *ctx);
+void cli_close(struct thread_ctx_s *ctx);
+char *cli_decode(char *str);
+char *cli_send_cmd(char *cmd, bool req, bool decode, struct thread_ctx_s *ctx);
+bool cli_send_cmd_async(char *cmd, bool req, bool decode, cli_callback_t callback, void *arg, struct thread_ctx_s *ctx);
+u16_t cli_http_port(struct thread_ctx_s *ctx);
+int cli_parse_status(char *rsp, bool next, u32_t *cur, sq_metadata_t *items, int count);
+
+// main.c
+#define STATUS_ITEMS	3
+
+void playlist_notify(struct thread_ctx_s *ctx);
+void sq_copy_metadata(sq_metadata_t *dst, sq_metadata_t *src);
+void playlist_invalidate(struct thread_ctx_s *ctx);
+
+// metacache.c
+void metacache_init(void);
+void metacache_close(void);
+bool metacache_get(char *path, sq_metadata_t *metadata);
+void metacache_put(sq_metadata_t *metadata);
 
 // stream.c
 typedef enum { STOPPED = 0, DISCONNECT, STREAMING_WAIT,
@@ -474,8 +543,6 @@ typedef struct {
 	u32_t	ms_played;
 } status_t;
 
-typedef enum {TRACK_STOPPED = 0, TRACK_STARTED, TRACK_PAUSED} track_status_t;
-
 #define PLAYER_NAME_LEN 64
 #define SERVER_NAME_LEN	250
 #define MAX_PLAYER		32
@@ -508,6 +575,7 @@ struct thread_ctx_s {
 	bool 	sentSTMu, sentSTMo, sentSTMl, sentSTMd;
 	u32_t 	new_server;
 	char 	*new_server_cap;
+	bool	caps_changed;
 	char	fixed_cap[128], var_cap[128];
 	char 	player_name[PLAYER_NAME_LEN + 1];
 	status_t			status;
@@ -527,10 +595,10 @@ struct thread_ctx_s {
 	in_addr_t 	slimproto_ip;
 	unsigned 	slimproto_port;
 	char		server[SERVER_NAME_LEN + 1];
-	sockfd 		sock, fd, cli_sock;
+	sockfd 		sock, fd;
 	u8_t 		mac[6];
 	char		cli_id[18];		// (6*2)+(5*':')+NULL
-	mutex_type	cli_mutex;
+	struct cli_s	*cli;		// shared with players of the same server
 //	u8_t *buf;					// for output_mr
 //	unsigned buffill;			// for output_mr
 	int bytes_per_frame;		// for output_mr
@@ -555,13 +623,28 @@ struct thread_ctx_s {
 	u32_t	ms_played;
 	u32_t	start_at;
 	u32_t	ms_pause;
-	track_status_t	track_status;
+	player_state_t	state;		// only changed by the slimproto thread
 	bool	track_ended;
 	bool	track_new;
-	bool	play_running;
 	u32_t	track_start_time;
 	bool	read_to;
 	bool	read_ended;
+	u32_t	play_request;		// when Play was requested, for calibration
+	u32_t	read_end_time;		// when last byte was read, for calibration
+#if DEADLINE_TIMER
+	int		deadline;			// timerfd armed at start_at
+#endif
+	u64_t	deadline_at;		// start_at in us, to log accuracy
+	struct {					// from CLI notifications and prefetch
+		u32_t	gen;
+		bool	valid;
+		u32_t	index;
+		bool	ordered;				// neither shuffle nor repeat song
+		char	*path[STATUS_ITEMS];	// items index, index + 1 ...
+	} playlist;
+	struct event_queue	events;	// fed by stream, sq_read, uPNP and timer
+	struct trace_record	trace[TRACE_SIZE];
+	unsigned			trace_idx;
 };
 
 extern struct thread_ctx_s thread_ctx[MAX_PLAYER];
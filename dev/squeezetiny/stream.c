@@ -47,7 +47,7 @@ static void send_header(struct thread_ctx_s *ctx) {
 			LOG_INFO("[%p] failed writing to socket: %s", ctx, strerror(last_error()));
 			ctx->stream.disconnect = LOCAL_DISCONNECT;
 			ctx->stream.state = DISCONNECT;
-			wake_controller(ctx);
+			player_event(ctx, EV_STREAM);
 			return;
 		}
 		LOG_SDEBUG("[%p] wrote %d bytes to socket", ctx, n);
@@ -75,7 +75,7 @@ static void _disconnect(stream_state state, disconnect_code disconnect, struct t
 	ctx->stream.disconnect = disconnect;
 	closesocket(ctx->fd);
 	ctx->fd = -1;
-	wake_controller(ctx);
+	player_event(ctx, EV_STREAM);
 }
 
 static void *stream_thread(struct thread_ctx_s *ctx) {
@@ -178,7 +178,7 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 							*(ctx->stream.header + ctx->stream.header_len) = '\0';
 							LOG_INFO("[%p] headers: len: %d\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
 							ctx->stream.state = ctx->stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller(ctx);
+							player_event(ctx, EV_STREAM);
 						}
 					} else {
 						endtok = 0;
@@ -231,7 +231,7 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 							*(ctx->stream.header + ctx->stream.header_len) = '\0';
 							LOG_INFO("[%p] icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
 							ctx->stream.meta_send = true;
-							wake_controller(ctx);
+							player_event(ctx, EV_STREAM);
 						}
 						ctx->stream.meta_next = ctx->stream.meta_interval;
 						UNLOCK_S;
@@ -269,7 +269,7 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 
 					if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
 						ctx->stream.state = STREAMING_HTTP;
-						wake_controller(ctx);
+						player_event(ctx, EV_STREAM);
 					}
 
 					LOG_SDEBUG("[%p] streambuf read %d bytes", ctx, n);
@@ -363,7 +363,7 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 		LOG_INFO("[%p] can't open file: %s", ctx, ctx->stream.header);
 		ctx->stream.state = DISCONNECT;
 	}
-	wake_controller(ctx);
+	player_event(ctx, EV_STREAM);
 
 	ctx->stream.cont_wait = false;
 	ctx->stream.meta_interval = 0;
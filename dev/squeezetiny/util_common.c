@@ -171,3 +171,109 @@ char *stristr(char *s1, char *s2)
 
 
 
+/*---------------------------------------------------------------------------*/
+/* hash table of string keys (FNV-1a), chained, keys are copied              */
+/*---------------------------------------------------------------------------*/
+static u32_t hash_key(const char *key)
+{
+	u32_t hash = 2166136261U;
+
+	while (*key) {
+		hash ^= (u8_t) *key++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*---------------------------------------------------------------------------*/
+void hash_init(hash_t *hash, u32_t size)
+{
+	hash->size = size;
+	hash->buckets = calloc(size, sizeof(struct hash_item_s*));
+	mutex_create(hash->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void hash_free(hash_t *hash)
+{
+	u32_t i;
+
+	if (!hash->buckets) return;
+
+	for (i = 0; i < hash->size; i++) {
+		struct hash_item_s *p, *next;
+		for (p = hash->buckets[i]; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+	}
+
+	NFREE(hash->buckets);
+	mutex_destroy(hash->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void hash_put(hash_t *hash, const char *key, void *value)
+{
+	struct hash_item_s *item, **p;
+	u32_t h;
+
+	if (!key || !*key) return;
+
+	h = hash_key(key);
+	item = malloc(sizeof(struct hash_item_s) + strlen(key) + 1);
+	item->hash = h;
+	item->value = value;
+	strcpy(item->key, key);
+
+	// latest wins when a key is reused
+	mutex_lock(hash->mutex);
+	p = hash->buckets + h % hash->size;
+	item->next = *p;
+	*p = item;
+	mutex_unlock(hash->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void *hash_get(hash_t *hash, const char *key)
+{
+	struct hash_item_s *p;
+	void *value = NULL;
+	u32_t h;
+
+	if (!key || !*key) return NULL;
+
+	h = hash_key(key);
+	mutex_lock(hash->mutex);
+	for (p = hash->buckets[h % hash->size]; p; p = p->next) {
+		if (p->hash == h && !strcmp(p->key, key)) {
+			value = p->value;
+			break;
+		}
+	}
+	mutex_unlock(hash->mutex);
+
+	return value;
+}
+
+/*---------------------------------------------------------------------------*/
+void hash_del(hash_t *hash, const char *key, void *value)
+{
+	struct hash_item_s **p;
+	u32_t h;
+
+	if (!key || !*key) return;
+
+	h = hash_key(key);
+	mutex_lock(hash->mutex);
+	for (p = hash->buckets + h % hash->size; *p; p = &(*p)->next) {
+		if ((*p)->hash == h && (*p)->value == value && !strcmp((*p)->key, key)) {
+			struct hash_item_s *item = *p;
+			*p = item->next;
+			free(item);
+			break;
+		}
+	}
+	mutex_unlock(hash->mutex);
+}
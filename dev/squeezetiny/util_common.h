@@ -27,6 +27,17 @@
 #define NFREE(p) if (p) { free(p); p = NULL; }
 typedef enum { lERROR = 0, lWARN, lINFO, lDEBUG, lSDEBUG } log_level;
 
+typedef struct {
+	mutex_type mutex;
+	u32_t size;
+	struct hash_item_s {
+		struct hash_item_s *next;
+		u32_t hash;
+		void *value;
+		char key[];
+	} **buckets;
+} hash_t;
+
 u32_t gettime_ms(void);
 const char *logtime(void);
 void logprint(const char *fmt, ...);
@@ -36,6 +47,12 @@ char *url_encode(char *str);
 char *url_decode(char *str);
 char *stristr(char *s1, char *s2);
 
+void hash_init(hash_t *hash, u32_t size);
+void hash_free(hash_t *hash);
+void hash_put(hash_t *hash, const char *key, void *value);
+void *hash_get(hash_t *hash, const char *key);
+void hash_del(hash_t *hash, const char *key, void *value);
+
 #define LOG_ERROR(fmt, ...) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_WARN(fmt, ...)  if (loglevel >= lWARN)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_INFO(fmt, ...)  if (loglevel >= lINFO)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
@@ -83,6 +83,23 @@ u32_t gettime_ms(void) {
 #endif
 }
 
+// same clock as gettime_ms, with us resolution
+u64_t gettime_us(void) {
+#if WIN
+	return (u64_t) GetTickCount() * 1000;
+#else
+#if LINUX || FREEBSD
+	struct timespec ts;
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return (u64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (u64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
 // mac address
 #if LINUX
 // search first 4 interfaces returned by IFCONF
@@ -245,6 +262,13 @@ void set_readwake_handles(event_handle handles[], sockfd s, event_event e) {
 #endif
 }
 
+#if DEADLINE_TIMER
+void set_deadline_handle(event_handle handles[], int t) {
+	handles[2].fd = t;
+	handles[2].events = POLLIN;
+}
+#endif
+
 event_type wait_readwake(event_handle handles[], int timeout) {
 #if WINEVENT
 	int wait = WSAWaitForMultipleEvents(2, handles, false, timeout, false);
@@ -257,7 +281,7 @@ event_type wait_readwake(event_handle handles[], int timeout) {
 		return EVENT_TIMEOUT;
 	}
 #else
-	if (poll(handles, 2, timeout) > 0) {
+	if (poll(handles, 2 + DEADLINE_TIMER, timeout) > 0) {
 		if (handles[0].revents) {
 			return EVENT_READ;
 		}
@@ -265,6 +289,13 @@ event_type wait_readwake(event_handle handles[], int timeout) {
 			wake_clear(handles[1].fd);
 			return EVENT_WAKE;
 		}
+#if DEADLINE_TIMER
+		if (handles[2].revents) {
+			u64_t expired;
+			read(handles[2].fd, &expired, sizeof(expired));
+			return EVENT_TIMER;
+		}
+#endif
 	}
 	return EVENT_TIMEOUT;
 #endif